@@ -5,93 +5,99 @@
 #include "dicm-log.h"
 #include "dicm-reader.h"
 #include "dicm-writer.h"
+#include "meta.h"
 
 #include <assert.h> /* assert */
 #include <errno.h>  /* errno */
 #include <stdio.h>  /* fopen */
 #include <stdlib.h> /* EXIT_SUCCESS */
 
-void process_writer(struct dicm_reader *reader, struct dicm_writer *writer) {
-  /* attribute */
-  struct dicm_attribute da;
-  /* value */
+struct copy {
+  struct dicm_reader *reader;
+  struct dicm_writer *writer;
+  /* of the last attribute */
+  dicm_tag_t tag;
+  /* transfer syntax of the copy */
+  struct meta_rewrite meta;
+};
+
+/* handlers forward every event to the writer */
+static int on_start_dataset(void *ctx, const char *encoding) {
+  struct copy *copy = (struct copy *)ctx;
+  meta_rewrite_init(&copy->meta, copy->reader);
+  return dicm_writer_write_start_dataset(copy->writer, encoding);
+}
+
+static int on_end_dataset(void *ctx) {
+  return dicm_writer_write_end_dataset(((struct copy *)ctx)->writer);
+}
+
+static int on_attribute(void *ctx, const struct dicm_attribute *da) {
+  struct copy *copy = (struct copy *)ctx;
+  copy->tag = da->tag;
+  return dicm_writer_write_attribute(copy->writer, da);
+}
+
+static int on_fragment(void *ctx) {
+  return dicm_writer_write_fragment(((struct copy *)ctx)->writer);
+}
+
+static int on_value(void *ctx, struct dicm_reader *reader, size_t size) {
+  struct copy *copy = (struct copy *)ctx;
+  struct dicm_writer *writer = copy->writer;
+  const int rewritten =
+      meta_rewrite_value(&copy->meta, copy->tag, reader, writer, size);
+  if (rewritten) return rewritten < 0 ? -1 : 0;
+  if (dicm_writer_write_value_length(writer, size)) return -1;
+  /* binary writer: value bytes go verbatim to the destination, let the io
+   * move them without a user space bounce when it can */
+  if (dicm_reader_transfer_value(reader, writer->dst, size) == 0) return 0;
+  /* refused before anything was consumed (no transfer between these io
+   * objects, or words to swap): copy, in whole words of up to 8 bytes */
   char buf[4096];
-  size_t size;
-  /* specific charactet set */
-  char encoding[64];
-  int res;
-
-  const size_t buflen = sizeof buf;
-
-  while (dicm_reader_hasnext(reader)) {
-    int next = dicm_reader_next_event(reader);
-    switch (next) {
-      case EVENT_ATTRIBUTE:
-        res = dicm_reader_get_attribute(reader, &da);
-        assert(res == 0);
-        res = dicm_writer_write_attribute(writer, &da);
-        assert(res == 0);
-        break;
-
-      case EVENT_VALUE:
-        res = dicm_reader_get_value_length(reader, &size);
-        assert(res == 0);
-        res = dicm_writer_write_value_length(writer, size);
-        assert(res == 0);
-        /* do/while loop trigger at least one event (even in the case where
-         * value_length is exactly 0) */
-        do {
-          const size_t len = size < buflen ? size : buflen;
-          res = dicm_reader_read_value(reader, buf, len);
-          assert(res == 0);
-          res = dicm_writer_write_value(writer, buf, len);
-          assert(res == 0);
-          size -= len;
-        } while (size != 0);
-        break;
-
-      case EVENT_FRAGMENT:
-        res = dicm_writer_write_fragment(writer);
-        assert(res == 0);
-        break;
-
-      case EVENT_START_ITEM:
-        res = dicm_writer_write_start_item(writer);
-        assert(res == 0);
-        break;
-
-      case EVENT_END_ITEM:
-        res = dicm_writer_write_end_item(writer);
-        assert(res == 0);
-        break;
-
-      case EVENT_START_SEQUENCE:
-        res = dicm_writer_write_start_sequence(writer);
-        assert(res == 0);
-        break;
-
-      case EVENT_END_SEQUENCE:
-        res = dicm_writer_write_end_sequence(writer);
-        assert(res == 0);
-        break;
-
-      case EVENT_START_DATASET:
-        res = dicm_reader_get_encoding(reader, encoding, sizeof encoding);
-        assert(res == 0);
-        res = dicm_writer_write_start_dataset(writer, encoding);
-        assert(res == 0);
-        break;
-
-      case EVENT_END_DATASET:
-        res = dicm_writer_write_end_dataset(writer);
-        assert(res == 0);
-        break;
-
-      default:
-        printf("wotsit: %d\n", next);
-        assert(0);
+  const size_t len24 = (sizeof buf / 24u) * 24u;
+  do {
+    const size_t len = size < len24 ? size : len24;
+    if (dicm_reader_read_value(reader, buf, len) ||
+        dicm_writer_write_value(writer, buf, len)) {
+      return -1;
     }
-  }
+    size -= len;
+  } while (size != 0);
+  return 0;
+}
+
+static int on_start_item(void *ctx) {
+  return dicm_writer_write_start_item(((struct copy *)ctx)->writer);
+}
+
+static int on_end_item(void *ctx) {
+  return dicm_writer_write_end_item(((struct copy *)ctx)->writer);
+}
+
+static int on_start_sequence(void *ctx) {
+  return dicm_writer_write_start_sequence(((struct copy *)ctx)->writer);
+}
+
+static int on_end_sequence(void *ctx) {
+  return dicm_writer_write_end_sequence(((struct copy *)ctx)->writer);
+}
+
+static const struct dicm_handlers handlers = {
+    .start_dataset = on_start_dataset,
+    .end_dataset = on_end_dataset,
+    .attribute = on_attribute,
+    .fragment = on_fragment,
+    .value = on_value,
+    .start_item = on_start_item,
+    .end_item = on_end_item,
+    .start_sequence = on_start_sequence,
+    .end_sequence = on_end_sequence};
+
+void process_writer(struct dicm_reader *reader, struct dicm_writer *writer) {
+  struct copy copy = {.reader = reader, .writer = writer};
+  const int res = dicm_reader_parse(reader, &handlers, &copy);
+  assert(res == 0);
 }
 
 int main(int argc, char *argv[]) {
@@ -5,6 +5,7 @@
 #include "dicm-log.h"
 #include "dicm-reader.h"
 #include "dicm-writer.h"
+#include "meta.h"
 
 #include <assert.h> /* assert */
 #include <errno.h>  /* errno */
@@ -16,12 +17,16 @@ void process_writer(struct dicm_reader *reader, struct dicm_writer *writer) {
   struct dicm_attribute da;
   /* value */
   char buf[4096];
+  const void *view;
   size_t size;
   /* specific charactet set */
   char encoding[64];
+  /* transfer syntax of the copy */
+  struct meta_rewrite meta;
 
-  /* FIXME: let's be lazy with base64 */
-  const size_t len3 = (sizeof buf / 3u) * 3u;
+  /* FIXME: let's be lazy with base64. Also whole words of big endian values,
+   * up to 8 bytes */
+  const size_t len3 = (sizeof buf / 24u) * 24u;
   assert(len3 <= sizeof buf && len3 % 3 == 0);
 
   while (dicm_reader_hasnext(reader)) {
@@ -34,7 +39,13 @@ void process_writer(struct dicm_reader *reader, struct dicm_writer *writer) {
 
       case EVENT_VALUE:
         dicm_reader_get_value_length(reader, &size);
+        if (meta_rewrite_value(&meta, da.tag, reader, writer, size)) break;
         dicm_writer_write_value_length(writer, size);
+        /* zero-copy when src is memory mapped */
+        if (dicm_reader_borrow_value(reader, &view, size) == 0) {
+          dicm_writer_write_value(writer, view, size);
+          break;
+        }
         /* do/while loop trigger at least one event (even in the case where
          * value_length is exactly 0) */
         do {
@@ -66,6 +77,7 @@ void process_writer(struct dicm_reader *reader, struct dicm_writer *writer) {
         break;
 
       case EVENT_START_DATASET:
+        meta_rewrite_init(&meta, reader);
         dicm_reader_get_encoding(reader, encoding, sizeof encoding);
         dicm_writer_write_start_dataset(writer, encoding);
         break;
@@ -91,7 +103,15 @@ int main(int argc, char *argv[]) {
 
   struct dicm_io *src;
   struct dicm_io *dst;
-  dicm_io_file_create(&src, filename, DICM_IO_READ);
+  int err = 1;
+#ifdef DICM_HAVE_POSIX_IO
+  err = dicm_io_mmap_create(&src, filename);
+#endif
+  if (err) {
+    dicm_io_file_create(&src, filename, DICM_IO_READ);
+  }
+  /* single pass over the whole instance */
+  dicm_io_advise(src, DICM_IO_ADVICE_SEQUENTIAL, 0);
   dicm_io_file_create(&dst, "output.json", DICM_IO_WRITE);
 
   struct dicm_reader *reader;
@@ -5,6 +5,7 @@
 #include "dicm-log.h"
 #include "dicm-reader.h"
 #include "dicm-writer.h"
+#include "meta.h"
 
 #include <assert.h> /* assert */
 #include <errno.h>  /* errno */
@@ -19,9 +20,12 @@ void process_writer(struct dicm_reader *reader, struct dicm_writer *writer) {
   size_t size;
   /* specific charactet set */
   char encoding[64];
+  /* transfer syntax of the copy */
+  struct meta_rewrite meta;
 
-  /* FIXME: let's be lazy with base64 */
-  const size_t len3 = (sizeof buf / 3u) * 3u;
+  /* FIXME: let's be lazy with base64. Also whole words of big endian values,
+   * up to 8 bytes */
+  const size_t len3 = (sizeof buf / 24u) * 24u;
   assert(len3 <= sizeof buf && len3 % 3 == 0);
 
   while (dicm_reader_hasnext(reader)) {
@@ -36,6 +40,7 @@ void process_writer(struct dicm_reader *reader, struct dicm_writer *writer) {
 
       case EVENT_VALUE:
         dicm_reader_get_value_length(reader, &size);
+        if (meta_rewrite_value(&meta, da.tag, reader, writer, size)) break;
         dicm_writer_write_value_length(writer, size);
         /* do/while loop trigger at least one event (even in the case where
          * value_length is exactly 0) */
@@ -68,6 +73,7 @@ void process_writer(struct dicm_reader *reader, struct dicm_writer *writer) {
         break;
 
       case EVENT_START_DATASET:
+        meta_rewrite_init(&meta, reader);
         dicm_reader_get_encoding(reader, encoding, sizeof encoding);
         dicm_writer_write_start_dataset(writer, encoding);
         break;
@@ -0,0 +1,225 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE /* O_DIRECT */
+#define _FILE_OFFSET_BITS 64
+
+#include "dicm-io.h"
+
+#include "dicm-log.h"
+#include "dicm-public.h"
+
+#include <assert.h> /* assert */
+#include <errno.h>
+#include <fcntl.h>  /* open */
+#include <stdint.h> /* uintptr_t */
+#include <stdlib.h>
+#include <string.h>   /* memcpy */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h>   /* pread */
+
+enum {
+  /* offset, length and buffer address alignment required by O_DIRECT. The
+   * logical block size is 512 or 4096 on current devices, use the larger */
+  DIRECT_ALIGNMENT = 4096
+};
+
+struct _direct {
+  struct dicm_io io;
+  /* data */
+  int fd;
+  /* aligned bounce buffer, holding len bytes read from file offset base */
+  unsigned char *buf;
+  size_t capacity;
+  size_t len;
+  io_offset base;
+  /* cursor is base + pos, pos may be past len */
+  size_t pos;
+  /* of the file when opened, -1 when not a regular file */
+  io_offset size;
+};
+
+static DICM_CHECK_RETURN int _direct_destroy(void *self_) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _direct_read(void *self_, void *buf,
+                                               size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN io_offset _direct_skip(void *self_,
+                                                io_offset off) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _direct_write(void *self_, void const *buf,
+                                                size_t size) DICM_NONNULL;
+
+static struct io_vtable const g_vtable = {
+    /* object interface */
+    .object = {.fp_destroy = _direct_destroy},
+    /* io interface */
+    .io = {.fp_read = _direct_read,
+           .fp_skip = _direct_skip,
+           .fp_write = _direct_write}};
+
+int dicm_io_direct_create(struct dicm_io **pself, const char *filename,
+                          size_t buffer_size) {
+  int errsv = 0;
+  struct _direct *self = (struct _direct *)malloc(sizeof(*self));
+  errsv = errno; /* ENOMEM */
+  if (self) {
+    /* round up to the next aligned size */
+    const size_t capacity =
+        buffer_size ? (buffer_size + DIRECT_ALIGNMENT - 1) /
+                          DIRECT_ALIGNMENT * DIRECT_ALIGNMENT
+                    : 1024 * 1024;
+    void *buf = NULL;
+    errsv = posix_memalign(&buf, DIRECT_ALIGNMENT, capacity);
+    if (!errsv) {
+#ifdef O_DIRECT
+      int fd = open(filename, O_RDONLY | O_DIRECT);
+      /* some file systems (older tmpfs...) refuse O_DIRECT */
+      if (fd == -1 && errno == EINVAL) fd = open(filename, O_RDONLY);
+#else
+      const int fd = open(filename, O_RDONLY);
+#endif
+      errsv = errno;
+      if (fd != -1) {
+        *pself = &self->io;
+        self->io.vtable = &g_vtable;
+        self->fd = fd;
+        self->buf = buf;
+        self->capacity = capacity;
+        self->len = 0;
+        self->base = 0;
+        self->pos = 0;
+        struct stat sb;
+        self->size = fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)
+                         ? (io_offset)sb.st_size
+                         : -1;
+        return 0;
+      }
+      free(buf);
+    }
+    free(self);
+  }
+  // log_errno(debug, errsv); // FIXME
+  *pself = NULL;
+  return errsv;
+}
+
+int _direct_destroy(void *const self_) {
+  int errsv = 0;
+  struct _direct *self = (struct _direct *)self_;
+  if (close(self->fd)) errsv = errno;
+  free(self->buf);
+  free(self);
+  return errsv;
+}
+
+/* reload the buffer from the aligned offset at or before the cursor */
+static int _direct_fill(struct _direct *self) {
+  const io_offset cursor = self->base + (io_offset)self->pos;
+  self->base = cursor - cursor % DIRECT_ALIGNMENT;
+  self->pos = (size_t)(cursor - self->base);
+  self->len = 0;
+  /* pread(2) may return less than requested, only stop at end of file */
+  while (self->len != self->capacity) {
+    const ssize_t ret =
+        pread(self->fd, self->buf + self->len, self->capacity - self->len,
+              (off_t)(self->base + (io_offset)self->len));
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret < 0) return 1;
+    if (ret == 0) break;
+    self->len += (size_t)ret;
+    /* a short read past an unaligned length is the end of file */
+    if (self->len % DIRECT_ALIGNMENT) break;
+  }
+  return 0;
+}
+
+/* read size bytes, a multiple of the alignment, from the aligned cursor
+ * straight into the aligned buf. The bounce buffer is left empty */
+static io_ssize _direct_read_aligned(struct _direct *self, void *buf,
+                                     size_t size) {
+  const io_offset cursor = self->base + (io_offset)self->pos;
+  size_t read = 0;
+  while (read != size) {
+    const ssize_t ret = pread(self->fd, (char *)buf + read, size - read,
+                              (off_t)(cursor + (io_offset)read));
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret < 0) return -1;
+    if (ret == 0) break;
+    read += (size_t)ret;
+    if (read % DIRECT_ALIGNMENT) break;
+  }
+  self->base = cursor + (io_offset)read;
+  self->pos = 0;
+  self->len = 0;
+  return (io_ssize)read;
+}
+
+io_ssize _direct_read(void *const self_, void *buf, size_t size) {
+  struct _direct *self = (struct _direct *)self_;
+  size_t read = 0;
+  while (read != size) {
+    if (self->pos >= self->len) {
+      /* whole aligned blocks need no bounce */
+      const io_offset cursor = self->base + (io_offset)self->pos;
+      char *dst = (char *)buf + read;
+      const size_t blocks =
+          (size - read) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+      if (blocks && cursor % DIRECT_ALIGNMENT == 0 &&
+          (uintptr_t)dst % DIRECT_ALIGNMENT == 0) {
+        const io_ssize ret = _direct_read_aligned(self, dst, blocks);
+        if (ret < 0) return -1;
+        read += (size_t)ret;
+        /* end of file */
+        if ((size_t)ret != blocks) break;
+        continue;
+      }
+      if (_direct_fill(self)) return -1;
+      /* end of file */
+      if (self->pos >= self->len) break;
+    }
+    const size_t available = self->len - self->pos;
+    const size_t len = size - read < available ? size - read : available;
+    memcpy((char *)buf + read, self->buf + self->pos, len);
+    self->pos += len;
+    read += len;
+  }
+  return (io_ssize)read;
+}
+
+io_offset _direct_skip(void *const self_, io_offset off) {
+  struct _direct *self = (struct _direct *)self_;
+  const io_offset cursor = self->base + (io_offset)self->pos + off;
+  if (cursor < 0) return -1;
+  /* bytes that are not there mean a truncated file to the reader */
+  if (off > 0 && self->size >= 0 && cursor > self->size) return -1;
+  /* no system call, the buffer is reloaded on the next read */
+  if (cursor >= self->base) {
+    self->pos = (size_t)(cursor - self->base);
+  } else {
+    self->base = cursor;
+    self->pos = 0;
+    self->len = 0;
+  }
+  return cursor;
+}
+
+io_ssize _direct_write(DICM_UNUSED void *const self_,
+                       DICM_UNUSED void const *buf, DICM_UNUSED size_t size) {
+  /* read-only */
+  return -1;
+}
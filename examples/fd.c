@@ -18,135 +18,279 @@
  *  <http://www.gnu.org/licenses/>.
  *
  */
+#define _GNU_SOURCE /* copy_file_range */
+#define _FILE_OFFSET_BITS 64
+
 #include "dicm-io.h"
 
 #include "dicm-log.h"
 #include "dicm-public.h"
 
 #include <assert.h> /* assert */
-#include <stdio.h>  /* fopen */
-
 #include <errno.h>
-#include <stdio.h>
+#include <fcntl.h>  /* open, posix_fadvise */
+#include <limits.h> /* IOV_MAX */
+#include <stdatomic.h>
+#include <stddef.h> /* offsetof */
 #include <stdlib.h>
+#include <sys/stat.h> /* fstat */
+#include <sys/uio.h>  /* preadv */
+#include <unistd.h>  /* pread */
+
+/* shared by all cursors */
+struct _fdfile {
+  int fd;
+  atomic_int refcount;
+  /* last accepted dicm_io_advice */
+  atomic_int advice;
+  /* DICM_IO_READ or DICM_IO_WRITE */
+  int mode;
+};
 
-struct _file {
+struct _fd {
   struct dicm_io io;
   /* data */
-  FILE *stream;
-  const char *filename;
+  struct _fdfile *file;
+  /* explicit cursor, never the descriptor file offset */
+  io_offset offset;
 };
 
-#if 0
-// https://stackoverflow.com/questions/58670828/is-there-a-way-to-rewind-stdin-in-c
-static bool is_stream_seekable(FILE* stream) {
-  if (fseek(stdin, 0L, SEEK_SET)) {
-    return false;
-  }
-  return true;
-}
+static DICM_CHECK_RETURN int _fd_destroy(void *self_) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _fd_read(void *self_, void *buf,
+                                           size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN io_offset _fd_skip(void *self_,
+                                            io_offset off) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _fd_write(void *self_, void const *buf,
+                                            size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN int _fd_advise(void *self_, int advice,
+                                        size_t length) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _fd_readv(void *self_,
+                                            const struct dicm_iovec *iov,
+                                            size_t n) DICM_NONNULL;
+#ifdef __linux__
+static DICM_CHECK_RETURN io_ssize _fd_transfer(void *self_,
+                                               struct dicm_io *dst,
+                                               size_t size) DICM_NONNULL;
 #endif
 
-static DICM_CHECK_RETURN int _file_destroy(void *self_) DICM_NONNULL;
-static DICM_CHECK_RETURN int _file_read(void *self_, void *buf,
-                                        size_t size) DICM_NONNULL;
-static DICM_CHECK_RETURN int _file_seek(void *self_,
-                                        io_offset off) DICM_NONNULL;
-static DICM_CHECK_RETURN int _file_tell(void *self_,
-                                        io_offset *off) DICM_NONNULL;
-static DICM_CHECK_RETURN int _file_write(void *self_, void const *buf,
-                                         size_t size) DICM_NONNULL;
-
 static struct io_vtable const g_vtable = {
     /* object interface */
-    .object = {.fp_destroy = _file_destroy},
+    .object = {.fp_destroy = _fd_destroy},
     /* io interface */
-    .io = {.fp_read = _file_read,
-           .fp_seek = _file_seek,
-           .fp_tell = _file_tell,
-           .fp_write = _file_write}};
+    .io = {.fp_read = _fd_read,
+           .fp_skip = _fd_skip,
+           .fp_write = _fd_write,
+           .fp_advise = _fd_advise,
+           .fp_readv = _fd_readv,
+#ifdef __linux__
+           .fp_transfer = _fd_transfer
+#endif
+    }};
 
-int dicm_io_file_create(struct dicm_io **pself, const char *filename,
-                        int mode) {
-  int errsv = 0;
-  struct _file *self = (struct _file *)malloc(sizeof(*self));
-  errsv = errno; /* ENOMEM */
+static int _fd_create(struct dicm_io **pself, struct _fdfile *file,
+                      io_offset offset) {
+  struct _fd *self = (struct _fd *)malloc(sizeof(*self));
   if (self) {
     *pself = &self->io;
     self->io.vtable = &g_vtable;
-    assert(mode == DICM_IO_READ || mode == DICM_IO_WRITE);
-    FILE *stream =
-        mode == DICM_IO_READ ? fopen(filename, "rb") : fopen(filename, "wb");
-    errsv = errno;
-    self->stream = stream;
-    self->filename = filename;
-    // TODO:
-    // https://en.cppreference.com/w/c/io/setvbuf
-    if (stream) {
-      return 0;
-    }
+    self->file = file;
+    self->offset = offset;
+    return 0;
   }
-  // log_errno(debug, errsv); // FIXME
   *pself = NULL;
-  return errsv;
+  return errno; /* ENOMEM */
 }
 
-int dicm_io_stream_create(struct dicm_io **pself, int mode) {
+int dicm_io_fd_create(struct dicm_io **pself, const char *filename,
+                      int mode) {
   int errsv = 0;
-  struct _file *self = (struct _file *)malloc(sizeof(*self));
+  struct _fdfile *file = (struct _fdfile *)malloc(sizeof(*file));
   errsv = errno; /* ENOMEM */
-  if (self) {
-    *pself = &self->io;
-    self->io.vtable = &g_vtable;
+  if (file) {
     assert(mode == DICM_IO_READ || mode == DICM_IO_WRITE);
-    FILE *stream = mode == DICM_IO_READ ? stdin : stdout;
-    self->stream = stream;
-    self->filename = NULL;
-    return 0;
+    file->fd = mode == DICM_IO_READ
+                   ? open(filename, O_RDONLY)
+                   : open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    errsv = errno;
+    if (file->fd != -1) {
+      atomic_init(&file->refcount, 1);
+      atomic_init(&file->advice, DICM_IO_ADVICE_NORMAL);
+      file->mode = mode;
+      errsv = _fd_create(pself, file, 0);
+      if (!errsv) return 0;
+      close(file->fd);
+    }
+    free(file);
   }
   // log_errno(debug, errsv); // FIXME
   *pself = NULL;
   return errsv;
 }
 
-int _file_destroy(void *const self_) {
+int dicm_io_fd_clone(struct dicm_io **pclone, struct dicm_io *self_,
+                     io_offset offset) {
+  if (self_->vtable != &g_vtable) return EINVAL;
+  struct _fd *self = (struct _fd *)self_;
+  struct _fdfile *file = self->file;
+  atomic_fetch_add(&file->refcount, 1);
+  const int errsv = _fd_create(pclone, file, offset);
+  if (errsv) atomic_fetch_sub(&file->refcount, 1);
+  return errsv;
+}
+
+int _fd_destroy(void *const self_) {
   int errsv = 0;
-  struct _file *self = (struct _file *)self_;
-  if (self->filename) {
-    /* it is an error only if the stream was already opened */
-    if (self->stream && fclose(self->stream)) {
-      /* some failure */
-      errsv = errno;
+  struct _fd *self = (struct _fd *)self_;
+  struct _fdfile *file = self->file;
+  /* last cursor closes the file */
+  if (atomic_fetch_sub(&file->refcount, 1) == 1) {
+    if (atomic_load(&file->advice) == DICM_IO_ADVICE_HEADER_ONLY) {
+      /* best effort, only clean pages can be dropped */
+      (void)posix_fadvise(file->fd, 0, 0, POSIX_FADV_DONTNEED);
     }
+    if (close(file->fd)) errsv = errno;
+    free(file);
   }
   free(self);
   return errsv;
 }
 
-int _file_read(void *const self_, void *buf, size_t size) {
-  struct _file *self = (struct _file *)self_;
-  const size_t read = fread(buf, 1, size, self->stream);
-  /* fread() does not distinguish between end-of-file and error, and callers
-   * must use feof(3) and ferror(3) to determine which occurred. */
-  if (read != size) {
-    // TODO
-    return 1;
+io_ssize _fd_read(void *const self_, void *buf, size_t size) {
+  struct _fd *self = (struct _fd *)self_;
+  size_t read = 0;
+  /* pread(2) may return less than requested, only stop at end of file */
+  while (read != size) {
+    const ssize_t ret = pread(self->file->fd, (char *)buf + read,
+                              size - read, (off_t)(self->offset + read));
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret < 0) return -1;
+    if (ret == 0) break;
+    read += (size_t)ret;
   }
-  return 0;
+  self->offset += (io_offset)read;
+  return (io_ssize)read;
 }
 
-int _file_seek(void *const self_, io_offset off) { return 1; }
-int _file_tell(void *const self_, io_offset *off) {
-  *off = 0;
-  return 1;
+/* dicm_iovec is passed to preadv(2) as is */
+_Static_assert(sizeof(struct dicm_iovec) == sizeof(struct iovec) &&
+                   offsetof(struct dicm_iovec, base) ==
+                       offsetof(struct iovec, iov_base) &&
+                   offsetof(struct dicm_iovec, len) ==
+                       offsetof(struct iovec, iov_len),
+               "struct iovec layout");
+
+io_ssize _fd_readv(void *const self_, const struct dicm_iovec *iov, size_t n) {
+  struct _fd *self = (struct _fd *)self_;
+  io_ssize read = 0;
+  size_t i = 0;
+  while (i < n) {
+    const int count = n - i < IOV_MAX ? (int)(n - i) : IOV_MAX;
+    const ssize_t ret = preadv(self->file->fd, (const struct iovec *)(iov + i),
+                               count, (off_t)self->offset);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret < 0) return -1;
+    if (ret == 0) break;
+    self->offset += ret;
+    read += ret;
+    /* preadv(2) may return less than requested: finish the buffer it stopped
+     * in with pread(2), then go on with the next ones */
+    size_t left = (size_t)ret;
+    while (i < n && left >= iov[i].len) left -= iov[i++].len;
+    if (left) {
+      const size_t size = iov[i].len - left;
+      const io_ssize rest = _fd_read(self, (char *)iov[i].base + left, size);
+      if (rest < 0) return -1;
+      read += rest;
+      if ((size_t)rest != size) break;
+      i++;
+    }
+  }
+  return read;
 }
 
-int _file_write(void *const self_, void const *buf, size_t size) {
-  struct _file *self = (struct _file *)self_;
-  const size_t write = fwrite(buf, 1, size, self->stream);
-  if (write != size) {
-    // TODO
-    return 1;
+/* a skip over bytes that are not there means a truncated file to the reader,
+ * see _file_skip */
+static bool _fd_skip_past_end(const struct _fd *self, io_offset off) {
+  struct stat sb;
+  if (off <= 0 || self->file->mode != DICM_IO_READ ||
+      fstat(self->file->fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+    return false;
   }
-  return 0;
+  return off > sb.st_size - self->offset;
 }
+
+io_offset _fd_skip(void *const self_, io_offset off) {
+  struct _fd *self = (struct _fd *)self_;
+  /* the cursor is ours, only the file size is asked for */
+  if (self->offset + off < 0 || _fd_skip_past_end(self, off)) return -1;
+  self->offset += off;
+  return self->offset;
+}
+
+io_ssize _fd_write(void *const self_, void const *buf, size_t size) {
+  struct _fd *self = (struct _fd *)self_;
+  size_t write = 0;
+  while (write != size) {
+    const ssize_t ret = pwrite(self->file->fd, (const char *)buf + write,
+                               size - write, (off_t)(self->offset + write));
+    if (ret < 0 && errno == EINTR) continue;
+    /* no progress, e.g. a file size limit: retrying would spin */
+    if (ret <= 0) return -1;
+    write += (size_t)ret;
+  }
+  self->offset += (io_offset)write;
+  return (io_ssize)write;
+}
+
+/* the hint applies to the descriptor, hence to all cursors */
+int _fd_advise(void *const self_, int advice, size_t length) {
+  struct _fd *self = (struct _fd *)self_;
+  const int fd = self->file->fd;
+  int errsv;
+  switch (advice) {
+    case DICM_IO_ADVICE_NORMAL:
+      errsv = posix_fadvise(fd, 0, 0, POSIX_FADV_NORMAL);
+      break;
+    case DICM_IO_ADVICE_SEQUENTIAL:
+      errsv = posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      break;
+    case DICM_IO_ADVICE_RANDOM:
+      errsv = posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+      break;
+    case DICM_IO_ADVICE_HEADER_ONLY:
+      errsv = posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+      /* a zero length would mean up to the end of file */
+      if (!errsv && length) {
+        errsv = posix_fadvise(fd, (off_t)self->offset, (off_t)length,
+                              POSIX_FADV_WILLNEED);
+      }
+      break;
+    default:
+      return EINVAL;
+  }
+  if (!errsv) atomic_store(&self->file->advice, advice);
+  return errsv;
+}
+
+#ifdef __linux__
+io_ssize _fd_transfer(void *const self_, struct dicm_io *dst_, size_t size) {
+  struct _fd *self = (struct _fd *)self_;
+  if (dst_->vtable != &g_vtable) return -1;
+  struct _fd *dst = (struct _fd *)dst_;
+  /* both cursors are explicit, this is exactly copy_file_range(2) */
+  off_t off_in = (off_t)self->offset;
+  off_t off_out = (off_t)dst->offset;
+  size_t moved = 0;
+  while (moved != size) {
+    const ssize_t ret = copy_file_range(self->file->fd, &off_in, dst->file->fd,
+                                        &off_out, size - moved, 0);
+    if (ret < 0 && errno == EINTR) continue;
+    /* EXDEV, EINVAL, ENOSYS... */
+    if (ret <= 0) break;
+    moved += (size_t)ret;
+  }
+  self->offset += (io_offset)moved;
+  dst->offset += (io_offset)moved;
+  return moved ? (io_ssize)moved : -1;
+}
+#endif
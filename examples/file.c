@@ -18,6 +18,7 @@
  *  <http://www.gnu.org/licenses/>.
  *
  */
+#define _GNU_SOURCE /* copy_file_range */
 #define _LARGEFILE_SOURCE
 #define _FILE_OFFSET_BITS 64
 
@@ -30,26 +31,29 @@
 #include <stdio.h>  /* fopen */
 
 #include <errno.h>
+#include <fcntl.h> /* posix_fadvise */
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h> /* fstat */
+
+#ifdef __linux__
+#include <sys/sendfile.h> /* sendfile */
+#include <unistd.h>       /* copy_file_range */
+#endif
 
 struct _file {
   struct dicm_io io;
   /* data */
   FILE *stream;
   const char *filename;
+  /* number of bytes consumed so far, pipes cannot ftello */
+  io_offset offset;
+  /* last accepted dicm_io_advice */
+  int advice;
+  /* DICM_IO_READ or DICM_IO_WRITE */
+  int mode;
 };
 
-#if 0
-// https://stackoverflow.com/questions/58670828/is-there-a-way-to-rewind-stdin-in-c
-static bool is_stream_seekable(FILE* stream) {
-  if (fseek(stdin, 0L, SEEK_SET)) {
-    return false;
-  }
-  return true;
-}
-#endif
-
 static DICM_CHECK_RETURN int _file_destroy(void *self_) DICM_NONNULL;
 static DICM_CHECK_RETURN io_ssize _file_read(void *self_, void *buf,
                                              size_t size) DICM_NONNULL;
@@ -57,13 +61,26 @@ static DICM_CHECK_RETURN io_offset _file_skip(void *self_,
                                               io_offset off) DICM_NONNULL;
 static DICM_CHECK_RETURN io_ssize _file_write(void *self_, void const *buf,
                                               size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN int _file_advise(void *self_, int advice,
+                                          size_t length) DICM_NONNULL;
+#ifdef __linux__
+static DICM_CHECK_RETURN io_ssize _file_transfer(void *self_,
+                                                 struct dicm_io *dst,
+                                                 size_t size) DICM_NONNULL;
+#endif
 
 static struct io_vtable const g_vtable = {
     /* object interface */
     .object = {.fp_destroy = _file_destroy},
     /* io interface */
-    .io = {
-        .fp_read = _file_read, .fp_skip = _file_skip, .fp_write = _file_write}};
+    .io = {.fp_read = _file_read,
+           .fp_skip = _file_skip,
+           .fp_write = _file_write,
+           .fp_advise = _file_advise,
+#ifdef __linux__
+           .fp_transfer = _file_transfer
+#endif
+    }};
 
 int dicm_io_file_create(struct dicm_io **pself, const char *filename,
                         int mode) {
@@ -79,8 +96,12 @@ int dicm_io_file_create(struct dicm_io **pself, const char *filename,
     errsv = errno;
     self->stream = stream;
     self->filename = filename;
-    // TODO:
-    // https://en.cppreference.com/w/c/io/setvbuf
+    self->offset = 0;
+    self->advice = DICM_IO_ADVICE_NORMAL;
+    self->mode = mode;
+    /* stdio buffering is left as is: the reader asks for whole blocks, which
+     * fread(3) hands straight to read(2). Page cache behavior is controlled
+     * with dicm_io_advise */
     if (stream) {
       return 0;
     }
@@ -101,6 +122,9 @@ int dicm_io_stream_create(struct dicm_io **pself, int mode) {
     FILE *stream = mode == DICM_IO_READ ? stdin : stdout;
     self->stream = stream;
     self->filename = NULL;
+    self->offset = 0;
+    self->advice = DICM_IO_ADVICE_NORMAL;
+    self->mode = mode;
     return 0;
   }
   // log_errno(debug, errsv); // FIXME
@@ -111,6 +135,10 @@ int dicm_io_stream_create(struct dicm_io **pself, int mode) {
 int _file_destroy(void *const self_) {
   int errsv = 0;
   struct _file *self = (struct _file *)self_;
+  if (self->stream && self->advice == DICM_IO_ADVICE_HEADER_ONLY) {
+    /* best effort, only clean pages can be dropped */
+    (void)posix_fadvise(fileno(self->stream), 0, 0, POSIX_FADV_DONTNEED);
+  }
   if (self->filename) {
     /* it is an error only if the stream was already opened */
     if (self->stream && fclose(self->stream)) {
@@ -131,14 +159,49 @@ io_ssize _file_read(void *const self_, void *buf, size_t size) {
     const int eof = feof(self->stream);
     const int error = ferror(self->stream);
     if (error) return -1;
-    assert(eof && read == 0);
+    assert(eof);
   }
+  self->offset += (io_offset)read;
   return read;
 }
 
+// https://stackoverflow.com/questions/58670828/is-there-a-way-to-rewind-stdin-in-c
+static io_offset _file_discard(struct _file *self, io_offset off) {
+  char buf[4096];
+  while (off != 0) {
+    const size_t len = off < (io_offset)sizeof buf ? (size_t)off : sizeof buf;
+    const size_t read = fread(buf, 1, len, self->stream);
+    self->offset += (io_offset)read;
+    if (read != len) return -1;
+    off -= (io_offset)len;
+  }
+  return self->offset;
+}
+
+/* fseeko(3) happily moves past the end of a file, whereas a skip over bytes
+ * that are not there means a truncated file to the reader */
+static bool _file_skip_past_end(struct _file *self, io_offset off) {
+  struct stat sb;
+  if (off <= 0 || self->mode != DICM_IO_READ ||
+      fstat(fileno(self->stream), &sb) != 0 || !S_ISREG(sb.st_mode)) {
+    return false;
+  }
+  const off_t pos = ftello(self->stream);
+  return pos >= 0 && off > sb.st_size - pos;
+}
+
 io_offset _file_skip(void *const self_, io_offset off) {
-  assert(0);
-  return 1;
+  struct _file *self = (struct _file *)self_;
+  if (_file_skip_past_end(self, off)) return -1;
+  if (fseeko(self->stream, off, SEEK_CUR) == 0) {
+    self->offset += off;
+    return self->offset;
+  }
+  /* pipe: can only move forward by reading */
+  if (errno == ESPIPE && off >= 0) {
+    return _file_discard(self, off);
+  }
+  return -1;
 }
 
 io_ssize _file_write(void *const self_, void const *buf, size_t size) {
@@ -148,5 +211,79 @@ io_ssize _file_write(void *const self_, void const *buf, size_t size) {
     // TODO
     return -1;
   }
+  self->offset += (io_offset)write;
   return write;
 }
+
+int _file_advise(void *const self_, int advice, size_t length) {
+  struct _file *self = (struct _file *)self_;
+  const int fd = fileno(self->stream);
+  int errsv;
+  switch (advice) {
+    case DICM_IO_ADVICE_NORMAL:
+      errsv = posix_fadvise(fd, 0, 0, POSIX_FADV_NORMAL);
+      break;
+    case DICM_IO_ADVICE_SEQUENTIAL:
+      errsv = posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      break;
+    case DICM_IO_ADVICE_RANDOM:
+      errsv = posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+      break;
+    case DICM_IO_ADVICE_HEADER_ONLY:
+      errsv = posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+      /* a zero length would mean up to the end of file */
+      if (!errsv && length) {
+        errsv = posix_fadvise(fd, (off_t)self->offset, (off_t)length,
+                              POSIX_FADV_WILLNEED);
+      }
+      break;
+    default:
+      return EINVAL;
+  }
+  /* pipe: nothing to advise */
+  if (errsv == ESPIPE) return 0;
+  if (!errsv) self->advice = advice;
+  return errsv;
+}
+
+#ifdef __linux__
+io_ssize _file_transfer(void *const self_, struct dicm_io *dst_, size_t size) {
+  struct _file *self = (struct _file *)self_;
+  if (dst_->vtable != &g_vtable) return -1;
+  struct _file *dst = (struct _file *)dst_;
+  /* explicit offsets take into account what stdio has buffered */
+  off_t off_in = ftello(self->stream);
+  if (off_in < 0 || fflush(dst->stream)) return -1;
+  const off_t start_out = ftello(dst->stream); /* -1 for pipes */
+  off_t off_out = start_out;
+  const int fd_in = fileno(self->stream);
+  const int fd_out = fileno(dst->stream);
+  bool use_sendfile = off_out < 0;
+  size_t moved = 0;
+  while (moved != size) {
+    const ssize_t ret =
+        use_sendfile
+            ? sendfile(fd_out, fd_in, &off_in, size - moved)
+            : copy_file_range(fd_in, &off_in, fd_out, &off_out, size - moved,
+                              0);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret < 0 && moved == 0 && !use_sendfile) {
+      /* EXDEV, EINVAL, ENOSYS... sendfile writes at the current offset of
+       * fd_out, which is in sync once flushed */
+      use_sendfile = true;
+      continue;
+    }
+    if (ret <= 0) break;
+    moved += (size_t)ret;
+  }
+  /* stdio does not know the kernel moved the offsets */
+  if (fseeko(self->stream, off_in, SEEK_SET)) return -1;
+  if (start_out >= 0 &&
+      fseeko(dst->stream, start_out + (off_t)moved, SEEK_SET)) {
+    return -1;
+  }
+  self->offset += (io_offset)moved;
+  dst->offset += (io_offset)moved;
+  return moved ? (io_ssize)moved : -1;
+}
+#endif
@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: LGPLv3
+#define _POSIX_C_SOURCE 200809L
+
+#include "dicm-public.h"
+
+#include "dicm-io.h"
+#include "dicm-reader.h"
+
+#include <fcntl.h>  /* posix_fadvise */
+#include <stdio.h>  /* printf */
+#include <stdlib.h> /* posix_memalign */
+#include <time.h>   /* clock_gettime */
+#include <unistd.h> /* close */
+
+/* usage: iobench file [warm]
+ *
+ * Read file once per io backend and block size, and report the throughput.
+ * "read" loops over dicm_io_read, "parse" walks every event and reads every
+ * value through a reader using the same block size. Unless warm is given the
+ * file is dropped from the page cache before each run, which is what a one
+ * pass streaming conversion sees. */
+
+enum backend { STDIO, FD, MMAP, DIRECT };
+
+static const char *const backend_names[] = {"stdio", "fd", "mmap", "direct"};
+
+static int create(struct dicm_io **pio, enum backend backend,
+                  const char *filename, size_t block_size) {
+  switch (backend) {
+    case STDIO:
+      return dicm_io_file_create(pio, filename, DICM_IO_READ);
+    case FD:
+      return dicm_io_fd_create(pio, filename, DICM_IO_READ);
+    case MMAP:
+      return dicm_io_mmap_create(pio, filename);
+    case DIRECT:
+      return dicm_io_direct_create(pio, filename, block_size);
+  }
+  return 1;
+}
+
+static void drop_cache(const char *filename) {
+  const int fd = open(filename, O_RDONLY);
+  if (fd == -1) return;
+  (void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static io_ssize run_read(struct dicm_io *io, char *buf, size_t block_size) {
+  io_ssize total = 0;
+  io_ssize ret;
+  while ((ret = dicm_io_read(io, buf, block_size)) > 0) total += ret;
+  return ret < 0 ? -1 : total;
+}
+
+static io_ssize run_parse(struct dicm_io *io, char *buf, size_t block_size) {
+  struct dicm_reader *reader;
+  if (dicm_reader_utf8_create(&reader, io)) return -1;
+  if (dicm_reader_set_block_size(reader, block_size)) {
+    (void)object_destroy(reader);
+    return -1;
+  }
+  io_ssize total = 0;
+  size_t size;
+  while (dicm_reader_hasnext(reader)) {
+    const int next = dicm_reader_next_event(reader);
+    if (next < 0) {
+      total = -1;
+      break;
+    }
+    if (next != EVENT_VALUE) continue;
+    if (dicm_reader_get_value_length(reader, &size)) {
+      total = -1;
+      break;
+    }
+    total += (io_ssize)size;
+    while (size != 0) {
+      const size_t len = size < block_size ? size : block_size;
+      if (dicm_reader_read_value(reader, buf, len)) {
+        total = -1;
+        break;
+      }
+      size -= len;
+    }
+    if (total < 0) break;
+  }
+  if (object_destroy(reader)) total = -1;
+  return total;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) return EXIT_FAILURE;
+  const char *filename = argv[1];
+  const int warm = argc > 2;
+
+  static const size_t block_sizes[] = {4096, 16 * 1024, 64 * 1024, 256 * 1024,
+                                       1024 * 1024};
+  const size_t max_block_size = 1024 * 1024;
+  /* aligned as O_DIRECT requires, so that the DIRECT rows read straight into
+   * it instead of copying from the io buffer */
+  void *mem;
+  if (posix_memalign(&mem, 4096, max_block_size)) return EXIT_FAILURE;
+  char *buf = mem;
+
+  printf("%-8s %8s %6s %10s %10s\n", "io", "block", "mode", "bytes", "MB/s");
+  for (size_t b = 0; b < sizeof block_sizes / sizeof *block_sizes; ++b) {
+    const size_t block_size = block_sizes[b];
+    for (int backend = STDIO; backend <= DIRECT; ++backend) {
+      for (int parse = 0; parse <= 1; ++parse) {
+        if (!warm) drop_cache(filename);
+        struct dicm_io *io;
+        if (create(&io, (enum backend)backend, filename, block_size)) {
+          fprintf(stderr, "%s: cannot open %s\n", backend_names[backend],
+                  filename);
+          continue;
+        }
+        const double start = now();
+        const io_ssize total = parse ? run_parse(io, buf, block_size)
+                                     : run_read(io, buf, block_size);
+        const double elapsed = now() - start;
+        if (object_destroy(io) || total < 0) {
+          fprintf(stderr, "%s: failure reading %s\n", backend_names[backend],
+                  filename);
+          continue;
+        }
+        printf("%-8s %8zu %6s %10lld %10.1f\n", backend_names[backend],
+               block_size, parse ? "parse" : "read", (long long)total,
+               (double)total / elapsed / 1e6);
+      }
+    }
+  }
+  free(buf);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,227 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "dicm-io.h"
+
+#include "dicm-log.h"
+#include "dicm-public.h"
+
+#include <assert.h> /* assert */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h> /* memcpy */
+
+struct _mem {
+  struct dicm_io io;
+  /* data */
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+  size_t pos;
+};
+
+static DICM_CHECK_RETURN int _mem_destroy(void *self_) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _mem_read(void *self_, void *buf,
+                                            size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN io_offset _mem_skip(void *self_,
+                                             io_offset off) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _mem_write(void *self_, void const *buf,
+                                             size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _mem_borrow(void *self_, const void **buf,
+                                              size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _mem_transfer(void *self_,
+                                                struct dicm_io *dst,
+                                                size_t size) DICM_NONNULL;
+
+static DICM_CHECK_RETURN int _memsink_destroy(void *self_) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _memsink_read(void *self_, void *buf,
+                                                size_t size) DICM_NONNULL;
+
+/* source: caller-owned memory */
+static struct io_vtable const g_vtable = {
+    /* object interface */
+    .object = {.fp_destroy = _mem_destroy},
+    /* io interface */
+    .io = {.fp_read = _mem_read,
+           .fp_skip = _mem_skip,
+           .fp_write = _mem_write,
+           .fp_borrow = _mem_borrow,
+           .fp_transfer = _mem_transfer}};
+
+/* source: owned memory */
+static struct io_vtable const g_adopt_vtable = {
+    /* object interface */
+    .object = {.fp_destroy = _memsink_destroy},
+    /* io interface */
+    .io = {.fp_read = _mem_read,
+           .fp_skip = _mem_skip,
+           .fp_write = _mem_write,
+           .fp_borrow = _mem_borrow,
+           .fp_transfer = _mem_transfer}};
+
+/* sink: owned, growable memory */
+static struct io_vtable const g_sink_vtable = {
+    /* object interface */
+    .object = {.fp_destroy = _memsink_destroy},
+    /* io interface */
+    .io = {.fp_read = _memsink_read,
+           .fp_skip = _mem_skip,
+           .fp_write = _mem_write}};
+
+int dicm_io_mem_create(struct dicm_io **pself, const void *data, size_t size) {
+  struct _mem *self = (struct _mem *)malloc(sizeof(*self));
+  if (self) {
+    *pself = &self->io;
+    self->io.vtable = &g_vtable;
+    /* never written to, see _mem_write */
+    self->data = (unsigned char *)data;
+    self->size = size;
+    self->capacity = 0;
+    self->pos = 0;
+    return 0;
+  }
+  *pself = NULL;
+  return errno; /* ENOMEM */
+}
+
+int dicm_io_mem_adopt(struct dicm_io **pself, void *data, size_t size) {
+  struct _mem *self = (struct _mem *)malloc(sizeof(*self));
+  if (self) {
+    *pself = &self->io;
+    self->io.vtable = &g_adopt_vtable;
+    self->data = data;
+    self->size = size;
+    self->capacity = 0;
+    self->pos = 0;
+    return 0;
+  }
+  *pself = NULL;
+  return errno; /* ENOMEM */
+}
+
+int dicm_io_memsink_create(struct dicm_io **pself, size_t capacity) {
+  int errsv = 0;
+  struct _mem *self = (struct _mem *)malloc(sizeof(*self));
+  errsv = errno; /* ENOMEM */
+  if (self) {
+    unsigned char *data = capacity ? malloc(capacity) : NULL;
+    errsv = errno;
+    if (data || !capacity) {
+      *pself = &self->io;
+      self->io.vtable = &g_sink_vtable;
+      self->data = data;
+      self->size = 0;
+      self->capacity = capacity;
+      self->pos = 0;
+      return 0;
+    }
+    free(self);
+  }
+  *pself = NULL;
+  return errsv;
+}
+
+int dicm_io_memsink_release(struct dicm_io *self_, void **pdata,
+                            size_t *psize) {
+  if (self_->vtable != &g_sink_vtable) return EINVAL;
+  struct _mem *self = (struct _mem *)self_;
+  *pdata = self->data;
+  *psize = self->size;
+  /* ownership was transferred, start over empty */
+  self->data = NULL;
+  self->size = self->capacity = self->pos = 0;
+  return 0;
+}
+
+int _mem_destroy(void *const self_) {
+  struct _mem *self = (struct _mem *)self_;
+  free(self);
+  return 0;
+}
+
+int _memsink_destroy(void *const self_) {
+  struct _mem *self = (struct _mem *)self_;
+  free(self->data);
+  free(self);
+  return 0;
+}
+
+io_ssize _mem_read(void *const self_, void *buf, size_t size) {
+  struct _mem *self = (struct _mem *)self_;
+  const size_t remaining = self->size - self->pos;
+  const size_t read = size < remaining ? size : remaining;
+  memcpy(buf, self->data + self->pos, read);
+  self->pos += read;
+  return (io_ssize)read;
+}
+
+io_ssize _memsink_read(DICM_UNUSED void *const self_, DICM_UNUSED void *buf,
+                       DICM_UNUSED size_t size) {
+  /* write-only */
+  return -1;
+}
+
+io_offset _mem_skip(void *const self_, io_offset off) {
+  struct _mem *self = (struct _mem *)self_;
+  const io_offset pos = (io_offset)self->pos + off;
+  if (pos < 0 || pos > (io_offset)self->size) return -1;
+  self->pos = (size_t)pos;
+  return pos;
+}
+
+io_ssize _mem_write(void *const self_, void const *buf, size_t size) {
+  struct _mem *self = (struct _mem *)self_;
+  /* sources are read-only */
+  if (self->io.vtable != &g_sink_vtable) return -1;
+  const size_t end = self->pos + size;
+  if (end > self->capacity) {
+    size_t capacity = self->capacity ? self->capacity : 4096;
+    while (capacity < end) capacity *= 2;
+    unsigned char *data = realloc(self->data, capacity);
+    if (!data) return -1;
+    self->data = data;
+    self->capacity = capacity;
+  }
+  memcpy(self->data + self->pos, buf, size);
+  self->pos = end;
+  if (end > self->size) self->size = end;
+  return (io_ssize)size;
+}
+
+io_ssize _mem_borrow(void *const self_, const void **buf, size_t size) {
+  struct _mem *self = (struct _mem *)self_;
+  /* all or nothing, see fp_borrow */
+  if (size > self->size - self->pos) return -1;
+  *buf = self->data + self->pos;
+  self->pos += size;
+  return (io_ssize)size;
+}
+
+io_ssize _mem_transfer(void *const self_, struct dicm_io *dst,
+                       size_t size) {
+  struct _mem *self = (struct _mem *)self_;
+  const size_t remaining = self->size - self->pos;
+  const size_t len = size < remaining ? size : remaining;
+  /* straight from storage, no bounce buffer */
+  const io_ssize ssize = dicm_io_write(dst, self->data + self->pos, len);
+  if (ssize <= 0) return -1;
+  self->pos += (size_t)ssize;
+  return ssize;
+}
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: LGPLv3
+
+#include "meta.h"
+
+#include <stdint.h> /* uint32_t */
+#include <string.h> /* strcmp */
+
+static const char explicit_le[] = "1.2.840.10008.1.2.1";
+
+/* UI values are padded with a NUL to an even length */
+static size_t _padded_length(size_t len) { return len + (len & 1u); }
+
+void meta_rewrite_init(struct meta_rewrite *self, struct dicm_reader *reader) {
+  char ts[65];
+  self->active = false;
+  self->delta = 0;
+  /* without File Meta Information there is nothing to rewrite */
+  if (dicm_reader_get_transfer_syntax(reader, ts, sizeof ts)) return;
+  /* encapsulated Pixel Data stays as it is, hence its UID too */
+  if (strcmp(ts, "1.2.840.10008.1.2") != 0 &&
+      strcmp(ts, "1.2.840.10008.1.2.2") != 0 &&
+      strcmp(ts, "1.2.840.10008.1.2.1.99") != 0) {
+    return;
+  }
+  self->active = true;
+  self->delta = (int)_padded_length(sizeof explicit_le - 1) -
+                (int)_padded_length(strlen(ts));
+}
+
+int meta_rewrite_value(const struct meta_rewrite *self, dicm_tag_t tag,
+                       struct dicm_reader *reader, struct dicm_writer *writer,
+                       size_t size) {
+  if (!self->active) return 0;
+  if (tag == MAKE_TAG(0x0002, 0x0000) && size == 4) {
+    uint32_t group_length;
+    /* read little endian, whatever the source */
+    if (dicm_reader_read_value(reader, &group_length, 4)) return -1;
+    group_length = (uint32_t)((int64_t)group_length + self->delta);
+    if (dicm_writer_write_value_length(writer, 4) ||
+        dicm_writer_write_value(writer, &group_length, 4)) {
+      return -1;
+    }
+    return 1;
+  }
+  if (tag == MAKE_TAG(0x0002, 0x0010)) {
+    if (dicm_reader_skip_value(reader, size) ||
+        dicm_writer_write_value_length(writer, sizeof explicit_le) ||
+        dicm_writer_write_value(writer, explicit_le, sizeof explicit_le)) {
+      return -1;
+    }
+    return 1;
+  }
+  return 0;
+}
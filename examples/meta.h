@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: LGPLv3
+#pragma once
+
+#include "dicm-public.h"
+#include "dicm-reader.h"
+#include "dicm-writer.h"
+
+#include <stdbool.h> /* bool */
+#include <stddef.h>  /* size_t */
+
+/* writers encode Explicit VR Little Endian, and values are read that way
+ * (words swapped, stream inflated): a copy keeping the Transfer Syntax UID of
+ * an Implicit VR Little Endian, Explicit VR Big Endian or Deflated source
+ * would misstate its encoding. Such a UID is replaced with the one of
+ * Explicit VR Little Endian, and File Meta Information Group Length adjusted
+ * to match */
+struct meta_rewrite {
+  bool active;
+  /* change in the length of the padded UID */
+  int delta;
+};
+
+/* at EVENT_START_DATASET */
+void meta_rewrite_init(struct meta_rewrite *self, struct dicm_reader *reader);
+
+/* at EVENT_VALUE of attribute tag, before anything is written: return 1 when
+ * the value was consumed and its replacement written (length included), 0
+ * when the caller copies it, -1 on error */
+int meta_rewrite_value(const struct meta_rewrite *self, dicm_tag_t tag,
+                       struct dicm_reader *reader, struct dicm_writer *writer,
+                       size_t size);
@@ -0,0 +1,207 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "dicm-io.h"
+
+#include "dicm-log.h"
+#include "dicm-public.h"
+
+#include <assert.h> /* assert */
+#include <errno.h>
+#include <fcntl.h> /* open, posix_fadvise */
+#include <stdlib.h>
+#include <string.h>   /* memcpy */
+#include <sys/mman.h> /* mmap */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h>   /* close */
+
+struct _mmap {
+  struct dicm_io io;
+  /* data */
+  const unsigned char *data;
+  size_t size;
+  size_t pos;
+  /* kept open to drop the file from the page cache, see _mmap_destroy */
+  int fd;
+  /* last accepted dicm_io_advice */
+  int advice;
+};
+
+static DICM_CHECK_RETURN int _mmap_destroy(void *self_) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _mmap_read(void *self_, void *buf,
+                                             size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN io_offset _mmap_skip(void *self_,
+                                              io_offset off) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _mmap_write(void *self_, void const *buf,
+                                              size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _mmap_borrow(void *self_, const void **buf,
+                                               size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _mmap_transfer(void *self_,
+                                                 struct dicm_io *dst,
+                                                 size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN int _mmap_advise(void *self_, int advice,
+                                          size_t length) DICM_NONNULL;
+
+static struct io_vtable const g_vtable = {
+    /* object interface */
+    .object = {.fp_destroy = _mmap_destroy},
+    /* io interface */
+    .io = {.fp_read = _mmap_read,
+           .fp_skip = _mmap_skip,
+           .fp_write = _mmap_write,
+           .fp_borrow = _mmap_borrow,
+           .fp_transfer = _mmap_transfer,
+           .fp_advise = _mmap_advise}};
+
+int dicm_io_mmap_create(struct dicm_io **pself, const char *filename) {
+  int errsv = 0;
+  struct _mmap *self = (struct _mmap *)malloc(sizeof(*self));
+  errsv = errno; /* ENOMEM */
+  if (self) {
+    const int fd = open(filename, O_RDONLY);
+    errsv = errno;
+    if (fd != -1) {
+      struct stat sb;
+      void *data = NULL;
+      if (fstat(fd, &sb) == 0) {
+        /* mmap(2) refuses zero length mapping */
+        data = sb.st_size ? mmap(NULL, (size_t)sb.st_size, PROT_READ,
+                                 MAP_PRIVATE, fd, 0)
+                          : NULL;
+      } else {
+        data = MAP_FAILED;
+      }
+      errsv = errno;
+      if (data != MAP_FAILED) {
+        *pself = &self->io;
+        self->io.vtable = &g_vtable;
+        self->data = data;
+        self->size = (size_t)sb.st_size;
+        self->pos = 0;
+        self->fd = fd;
+        self->advice = DICM_IO_ADVICE_NORMAL;
+        return 0;
+      }
+      close(fd);
+    }
+    free(self);
+  }
+  // log_errno(debug, errsv); // FIXME
+  *pself = NULL;
+  return errsv;
+}
+
+int _mmap_destroy(void *const self_) {
+  int errsv = 0;
+  struct _mmap *self = (struct _mmap *)self_;
+  if (self->data && munmap((void *)self->data, self->size)) {
+    errsv = errno;
+  }
+  /* mapped pages cannot be dropped, hence after munmap */
+  if (self->advice == DICM_IO_ADVICE_HEADER_ONLY) {
+    (void)posix_fadvise(self->fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+  if (close(self->fd) && !errsv) errsv = errno;
+  free(self);
+  return errsv;
+}
+
+io_ssize _mmap_read(void *const self_, void *buf, size_t size) {
+  struct _mmap *self = (struct _mmap *)self_;
+  const size_t remaining = self->size - self->pos;
+  const size_t read = size < remaining ? size : remaining;
+  memcpy(buf, self->data + self->pos, read);
+  self->pos += read;
+  return (io_ssize)read;
+}
+
+io_offset _mmap_skip(void *const self_, io_offset off) {
+  struct _mmap *self = (struct _mmap *)self_;
+  const io_offset pos = (io_offset)self->pos + off;
+  if (pos < 0 || pos > (io_offset)self->size) return -1;
+  self->pos = (size_t)pos;
+  return pos;
+}
+
+io_ssize _mmap_write(DICM_UNUSED void *const self_,
+                     DICM_UNUSED void const *buf, DICM_UNUSED size_t size) {
+  /* read-only mapping */
+  return -1;
+}
+
+io_ssize _mmap_borrow(void *const self_, const void **buf, size_t size) {
+  struct _mmap *self = (struct _mmap *)self_;
+  /* all or nothing, see fp_borrow */
+  if (size > self->size - self->pos) return -1;
+  *buf = self->data + self->pos;
+  self->pos += size;
+  return (io_ssize)size;
+}
+
+io_ssize _mmap_transfer(void *const self_, struct dicm_io *dst,
+                        size_t size) {
+  struct _mmap *self = (struct _mmap *)self_;
+  const size_t remaining = self->size - self->pos;
+  const size_t len = size < remaining ? size : remaining;
+  /* straight from storage, no bounce buffer */
+  const io_ssize ssize = dicm_io_write(dst, self->data + self->pos, len);
+  if (ssize <= 0) return -1;
+  self->pos += (size_t)ssize;
+  return ssize;
+}
+
+int _mmap_advise(void *const self_, int advice, size_t length) {
+  struct _mmap *self = (struct _mmap *)self_;
+  /* nothing mapped */
+  if (!self->data) return 0;
+  void *data = (void *)self->data;
+  int errsv;
+  switch (advice) {
+    case DICM_IO_ADVICE_NORMAL:
+      errsv = posix_madvise(data, self->size, POSIX_MADV_NORMAL);
+      break;
+    case DICM_IO_ADVICE_SEQUENTIAL:
+      errsv = posix_madvise(data, self->size, POSIX_MADV_SEQUENTIAL);
+      break;
+    case DICM_IO_ADVICE_RANDOM:
+      errsv = posix_madvise(data, self->size, POSIX_MADV_RANDOM);
+      break;
+    case DICM_IO_ADVICE_HEADER_ONLY:
+      errsv = posix_madvise(data, self->size, POSIX_MADV_RANDOM);
+      if (!errsv && length) {
+        /* the range must start on a page boundary */
+        const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        const size_t start = self->pos - self->pos % page;
+        const size_t remaining = self->size - start;
+        const size_t end = self->pos + length - start;
+        errsv = posix_madvise((char *)data + start,
+                              end < remaining ? end : remaining,
+                              POSIX_MADV_WILLNEED);
+      }
+      break;
+    default:
+      return EINVAL;
+  }
+  if (!errsv) self->advice = advice;
+  return errsv;
+}
@@ -0,0 +1,477 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "dicm-io.h"
+
+#include "dicm-log.h"
+#include "dicm-public.h"
+
+#include <assert.h> /* assert */
+#include <errno.h>
+#include <fcntl.h> /* open */
+#include <stdlib.h>
+#include <string.h>   /* memset */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h>   /* pread */
+
+#ifdef DICM_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>    /* mmap */
+#include <sys/syscall.h> /* SYS_io_uring_setup */
+#endif
+
+enum SLOT_STAGES { SLOT_FREE = 0, SLOT_OPEN, SLOT_READ, SLOT_DONE };
+
+struct _slot {
+  enum SLOT_STAGES stage;
+  const char *filename;
+  void *user_data;
+  int fd;
+  unsigned char *data;
+  size_t size;
+  size_t pos;
+  int error;
+};
+
+struct _request {
+  const char *filename;
+  void *user_data;
+};
+
+#ifdef DICM_HAVE_IO_URING
+struct _ring {
+  int fd;
+  /* submission queue */
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned to_submit;
+  /* completion queue */
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  /* mappings */
+  void *sq_ptr;
+  size_t sq_size;
+  void *cq_ptr;
+  size_t cq_size;
+  size_t sqes_size;
+};
+#endif
+
+struct dicm_io_batch {
+#ifdef DICM_HAVE_IO_URING
+  struct _ring ring;
+#endif
+  /* io_uring is available */
+  bool async;
+  /* files in flight */
+  struct _slot *slots;
+  unsigned int depth;
+  unsigned int busy;
+  /* files not yet started */
+  struct _request *queue;
+  size_t queue_head;
+  size_t queue_size;
+  size_t queue_capacity;
+};
+
+#ifdef DICM_HAVE_IO_URING
+static bool _ring_setup(struct _ring *ring, unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof p);
+  const long fd = syscall(SYS_io_uring_setup, entries, &p);
+  /* ENOSYS, EPERM (seccomp) ... */
+  if (fd < 0) return false;
+  ring->fd = (int)fd;
+  ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+    ring->cq_size = 0;
+  }
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ptr = ring->sq_ptr;
+  if (ring->sq_ptr != MAP_FAILED && !single_mmap) {
+    ring->cq_ptr =
+        mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  }
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED ||
+      ring->sqes == MAP_FAILED) {
+    if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != MAP_FAILED && !single_mmap)
+      munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr != MAP_FAILED) munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    return false;
+  }
+  unsigned char *sq = ring->sq_ptr;
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+  ring->to_submit = 0;
+  unsigned char *cq = ring->cq_ptr;
+  ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return true;
+}
+
+/* OPENAT and READ came with 5.6, older kernels set up a ring that refuses
+ * them: their batches use pread(2) */
+static bool _ring_probe(struct _ring *ring) {
+  enum { PROBE_OPS = 256 };
+  struct io_uring_probe *probe = calloc(
+      1, sizeof *probe + PROBE_OPS * sizeof(struct io_uring_probe_op));
+  if (!probe) return false;
+  /* EINVAL before 5.6 */
+  bool supported = syscall(SYS_io_uring_register, ring->fd,
+                           IORING_REGISTER_PROBE, probe, PROBE_OPS) == 0;
+  static const unsigned char ops[] = {IORING_OP_OPENAT, IORING_OP_READ,
+                                      IORING_OP_ASYNC_CANCEL};
+  for (size_t i = 0; supported && i < sizeof ops; ++i) {
+    supported = ops[i] <= probe->last_op &&
+                (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+  }
+  free(probe);
+  return supported;
+}
+
+static void _ring_free(struct _ring *ring) {
+  munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_size);
+  munmap(ring->sq_ptr, ring->sq_size);
+  close(ring->fd);
+}
+
+/* there is always room: at most one request per slot is in flight, the
+ * cancellations of dicm_io_batch_destroy being queued after they were
+ * submitted */
+static struct io_uring_sqe *_ring_get_sqe(struct _ring *ring) {
+  /* single producer */
+  const unsigned tail = *ring->sq_tail;
+  const unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof *sqe);
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+  return sqe;
+}
+
+static int _ring_submit_and_wait(struct _ring *ring, unsigned wait) {
+  const long ret =
+      syscall(SYS_io_uring_enter, ring->fd, ring->to_submit, wait,
+              wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (ret < 0) return errno;
+  ring->to_submit = 0;
+  return 0;
+}
+
+static void _slot_prep_open(struct dicm_io_batch *self, unsigned int index) {
+  struct _slot *slot = &self->slots[index];
+  struct io_uring_sqe *sqe = _ring_get_sqe(&self->ring);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (unsigned long)slot->filename;
+  sqe->open_flags = O_RDONLY;
+  sqe->user_data = index;
+  slot->stage = SLOT_OPEN;
+}
+
+static void _slot_prep_read(struct dicm_io_batch *self, unsigned int index) {
+  struct _slot *slot = &self->slots[index];
+  struct io_uring_sqe *sqe = _ring_get_sqe(&self->ring);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = slot->fd;
+  sqe->addr = (unsigned long)(slot->data + slot->pos);
+  /* a single request is limited to 2GB anyway */
+  const size_t len = slot->size - slot->pos;
+  sqe->len = len < 0x7ffff000 ? (unsigned)len : 0x7ffff000;
+  sqe->off = slot->pos;
+  sqe->user_data = index;
+  slot->stage = SLOT_READ;
+}
+#endif
+
+/* file is opened, allocate the buffer for its content */
+static int _slot_opened(struct _slot *slot) {
+  struct stat sb;
+  if (fstat(slot->fd, &sb)) return errno;
+  slot->size = (size_t)sb.st_size;
+  slot->pos = 0;
+  /* malloc(0) may return NULL */
+  slot->data = malloc(slot->size ? slot->size : 1);
+  if (!slot->data) return errno;
+  return 0;
+}
+
+static void _slot_done(struct _slot *slot, int error) {
+  if (slot->fd != -1) close(slot->fd);
+  slot->fd = -1;
+  slot->error = error;
+  slot->stage = SLOT_DONE;
+}
+
+int dicm_io_batch_create(struct dicm_io_batch **pself, unsigned int depth) {
+  int errsv = 0;
+  struct dicm_io_batch *self = malloc(sizeof(*self));
+  errsv = errno; /* ENOMEM */
+  if (self) {
+    if (depth == 0) depth = 1;
+    self->slots = calloc(depth, sizeof(struct _slot));
+    errsv = errno;
+    if (self->slots) {
+      self->depth = depth;
+      self->busy = 0;
+      self->queue = NULL;
+      self->queue_head = self->queue_size = self->queue_capacity = 0;
+#ifdef DICM_HAVE_IO_URING
+      self->async = _ring_setup(&self->ring, depth);
+      if (self->async && !_ring_probe(&self->ring)) {
+        _ring_free(&self->ring);
+        self->async = false;
+      }
+#else
+      self->async = false;
+#endif
+      *pself = self;
+      return 0;
+    }
+    free(self);
+  }
+  *pself = NULL;
+  return errsv;
+}
+
+#ifdef DICM_HAVE_IO_URING
+/* user_data of cancellations, next to slot indexes */
+#define CANCEL_USER_DATA (1ull << 63)
+
+/* the kernel cancels requests asynchronously, even when the ring is closed: a
+ * read running in a worker would still write to its buffer, an open would
+ * still return a descriptor. Cancel every request in flight and wait for all
+ * of them to complete before anything is freed */
+static void _batch_cancel_all(struct dicm_io_batch *self) {
+  struct _ring *ring = &self->ring;
+  unsigned in_flight = 0;
+  /* requests prepared since the last submission go first */
+  while (ring->to_submit && _ring_submit_and_wait(ring, 0) == EINTR) {
+  }
+  for (unsigned int i = 0; i < self->depth; ++i) {
+    const struct _slot *slot = &self->slots[i];
+    if (slot->stage != SLOT_OPEN && slot->stage != SLOT_READ) continue;
+    struct io_uring_sqe *sqe = _ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = i;
+    sqe->user_data = CANCEL_USER_DATA | i;
+    in_flight++;
+  }
+  while (in_flight) {
+    const int error = _ring_submit_and_wait(ring, 1);
+    if (error && error != EINTR) break;
+    unsigned head = *ring->cq_head;
+    const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+      if (cqe->user_data & CANCEL_USER_DATA) continue;
+      struct _slot *slot = &self->slots[cqe->user_data];
+      /* opened before it could be cancelled */
+      if (slot->stage == SLOT_OPEN && cqe->res >= 0) slot->fd = cqe->res;
+      slot->stage = SLOT_DONE;
+      in_flight--;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+}
+#endif
+
+int dicm_io_batch_destroy(struct dicm_io_batch *self) {
+#ifdef DICM_HAVE_IO_URING
+  if (self->async) {
+    _batch_cancel_all(self);
+    _ring_free(&self->ring);
+  }
+#endif
+  for (unsigned int i = 0; i < self->depth; ++i) {
+    struct _slot *slot = &self->slots[i];
+    if (slot->stage != SLOT_FREE) {
+      if (slot->fd != -1) close(slot->fd);
+      free(slot->data);
+    }
+  }
+  free(self->slots);
+  free(self->queue);
+  free(self);
+  return 0;
+}
+
+int dicm_io_batch_add(struct dicm_io_batch *self, const char *filename,
+                      void *user_data) {
+  if (self->queue_size == self->queue_capacity) {
+    /* reclaim what was already started */
+    memmove(self->queue, self->queue + self->queue_head,
+            (self->queue_size - self->queue_head) * sizeof(struct _request));
+    self->queue_size -= self->queue_head;
+    self->queue_head = 0;
+    if (self->queue_size == self->queue_capacity) {
+      const size_t capacity =
+          self->queue_capacity ? 2 * self->queue_capacity : 64;
+      struct _request *queue =
+          realloc(self->queue, capacity * sizeof(struct _request));
+      if (!queue) return errno;
+      self->queue = queue;
+      self->queue_capacity = capacity;
+    }
+  }
+  struct _request *request = &self->queue[self->queue_size++];
+  request->filename = filename;
+  request->user_data = user_data;
+  return 0;
+}
+
+static bool _batch_pop_request(struct dicm_io_batch *self,
+                               struct _slot *slot) {
+  if (self->queue_head == self->queue_size) return false;
+  const struct _request *request = &self->queue[self->queue_head++];
+  slot->filename = request->filename;
+  slot->user_data = request->user_data;
+  slot->fd = -1;
+  slot->data = NULL;
+  slot->error = 0;
+  return true;
+}
+
+/* pread(2) path, one file at a time */
+static void _batch_read_sync(struct _slot *slot) {
+  slot->fd = open(slot->filename, O_RDONLY);
+  if (slot->fd == -1) {
+    _slot_done(slot, errno);
+    return;
+  }
+  int error = _slot_opened(slot);
+  while (!error && slot->pos != slot->size) {
+    const ssize_t ret = pread(slot->fd, slot->data + slot->pos,
+                              slot->size - slot->pos, (off_t)slot->pos);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret < 0) error = errno;
+    /* file was truncated in the mean time */
+    if (ret == 0) slot->size = slot->pos;
+    if (ret > 0) slot->pos += (size_t)ret;
+  }
+  _slot_done(slot, error);
+}
+
+#ifdef DICM_HAVE_IO_URING
+static void _batch_complete(struct dicm_io_batch *self, unsigned int index,
+                            int res) {
+  struct _slot *slot = &self->slots[index];
+  if (res < 0) {
+    _slot_done(slot, -res);
+    return;
+  }
+  if (slot->stage == SLOT_OPEN) {
+    slot->fd = res;
+    const int error = _slot_opened(slot);
+    if (error || slot->size == 0) {
+      _slot_done(slot, error);
+    } else {
+      _slot_prep_read(self, index);
+    }
+  } else {
+    assert(slot->stage == SLOT_READ);
+    /* file was truncated in the mean time */
+    if (res == 0) slot->size = slot->pos;
+    slot->pos += (size_t)res;
+    if (slot->pos != slot->size) {
+      _slot_prep_read(self, index);
+    } else {
+      _slot_done(slot, 0);
+    }
+  }
+}
+
+static int _batch_run_async(struct dicm_io_batch *self) {
+  struct _ring *ring = &self->ring;
+  /* keep depth files in flight */
+  for (unsigned int i = 0; i < self->depth; ++i) {
+    struct _slot *slot = &self->slots[i];
+    if (slot->stage == SLOT_FREE && _batch_pop_request(self, slot)) {
+      self->busy++;
+      _slot_prep_open(self, i);
+    }
+  }
+  const int error = _ring_submit_and_wait(ring, 1);
+  if (error) return error == EINTR ? 0 : error;
+  unsigned head = *ring->cq_head;
+  const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    _batch_complete(self, (unsigned int)cqe->user_data, cqe->res);
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  return 0;
+}
+#endif
+
+int dicm_io_batch_next(struct dicm_io_batch *self, struct dicm_io **pio,
+                       void **puser_data) {
+  *pio = NULL;
+  while (1) {
+    for (unsigned int i = 0; i < self->depth; ++i) {
+      struct _slot *slot = &self->slots[i];
+      if (slot->stage != SLOT_DONE) continue;
+      *puser_data = slot->user_data;
+      slot->stage = SLOT_FREE;
+      self->busy--;
+      int error = slot->error;
+      if (!error) {
+        /* ownership of data goes to io */
+        error = dicm_io_mem_adopt(pio, slot->data, slot->size);
+        if (!error) return 0;
+      }
+      free(slot->data);
+      return error;
+    }
+    if (!self->async) {
+      if (!_batch_pop_request(self, &self->slots[0])) return -1;
+      self->busy++;
+      _batch_read_sync(&self->slots[0]);
+      continue;
+    }
+#ifdef DICM_HAVE_IO_URING
+    if (self->busy == 0 && self->queue_head == self->queue_size) return -1;
+    const int error = _batch_run_async(self);
+    if (error) return error;
+#endif
+  }
+}
@@ -0,0 +1,221 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "dicm-convert.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+bool value_type_widens(const int from, const int to) {
+  if (from == to) return true;
+  switch (to) {
+    case DICM_VALUE_INT32:
+      return from == DICM_VALUE_UINT16 || from == DICM_VALUE_INT16;
+    case DICM_VALUE_FLOAT64:
+      return true;
+  }
+  return false;
+}
+
+/* Source elements lie at the end of buf and are read before the destination
+ * element of the same index is written, which ends at or before the next
+ * source element: converting forward never clobbers unread input, one vector
+ * at a time included, as long as it is loaded before it is stored */
+
+#if defined(__SSE2__)
+static size_t _u16_to_i32_vector(unsigned char *dst, const unsigned char *src,
+                                 size_t n) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; n - i >= 8; i += 8) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(src));
+    _mm_storeu_si128((__m128i *)(void *)dst, _mm_unpacklo_epi16(v, zero));
+    _mm_storeu_si128((__m128i *)(void *)(dst + 16),
+                     _mm_unpackhi_epi16(v, zero));
+    src += 16;
+    dst += 32;
+  }
+  return i;
+}
+
+static size_t _i16_to_i32_vector(unsigned char *dst, const unsigned char *src,
+                                 size_t n) {
+  size_t i = 0;
+  for (; n - i >= 8; i += 8) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(src));
+    /* in the high half, then shifted down with the sign */
+    _mm_storeu_si128((__m128i *)(void *)dst,
+                     _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+    _mm_storeu_si128((__m128i *)(void *)(dst + 16),
+                     _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+    src += 16;
+    dst += 32;
+  }
+  return i;
+}
+
+static size_t _f32_to_f64_vector(unsigned char *dst, const unsigned char *src,
+                                 size_t n) {
+  size_t i = 0;
+  for (; n - i >= 4; i += 4) {
+    const __m128 v = _mm_loadu_ps((const float *)(const void *)src);
+    _mm_storeu_pd((double *)(void *)dst, _mm_cvtps_pd(v));
+    _mm_storeu_pd((double *)(void *)(dst + 16),
+                  _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    src += 16;
+    dst += 32;
+  }
+  return i;
+}
+#elif defined(__ARM_NEON)
+static size_t _u16_to_i32_vector(unsigned char *dst, const unsigned char *src,
+                                 size_t n) {
+  size_t i = 0;
+  for (; n - i >= 8; i += 8) {
+    const uint16x8_t v = vld1q_u16((const uint16_t *)(const void *)src);
+    vst1q_u32((uint32_t *)(void *)dst, vmovl_u16(vget_low_u16(v)));
+    vst1q_u32((uint32_t *)(void *)(dst + 16), vmovl_u16(vget_high_u16(v)));
+    src += 16;
+    dst += 32;
+  }
+  return i;
+}
+
+static size_t _i16_to_i32_vector(unsigned char *dst, const unsigned char *src,
+                                 size_t n) {
+  size_t i = 0;
+  for (; n - i >= 8; i += 8) {
+    const int16x8_t v = vld1q_s16((const int16_t *)(const void *)src);
+    vst1q_s32((int32_t *)(void *)dst, vmovl_s16(vget_low_s16(v)));
+    vst1q_s32((int32_t *)(void *)(dst + 16), vmovl_s16(vget_high_s16(v)));
+    src += 16;
+    dst += 32;
+  }
+  return i;
+}
+
+#if defined(__aarch64__)
+static size_t _f32_to_f64_vector(unsigned char *dst, const unsigned char *src,
+                                 size_t n) {
+  size_t i = 0;
+  for (; n - i >= 4; i += 4) {
+    const float32x4_t v = vld1q_f32((const float *)(const void *)src);
+    vst1q_f64((double *)(void *)dst, vcvt_f64_f32(vget_low_f32(v)));
+    vst1q_f64((double *)(void *)(dst + 16), vcvt_high_f64_f32(v));
+    src += 16;
+    dst += 32;
+  }
+  return i;
+}
+#else
+static size_t _f32_to_f64_vector(DICM_UNUSED unsigned char *dst,
+                                 DICM_UNUSED const unsigned char *src,
+                                 DICM_UNUSED size_t n) {
+  return 0;
+}
+#endif
+#else
+static size_t _u16_to_i32_vector(DICM_UNUSED unsigned char *dst,
+                                 DICM_UNUSED const unsigned char *src,
+                                 DICM_UNUSED size_t n) {
+  return 0;
+}
+
+static size_t _i16_to_i32_vector(DICM_UNUSED unsigned char *dst,
+                                 DICM_UNUSED const unsigned char *src,
+                                 DICM_UNUSED size_t n) {
+  return 0;
+}
+
+static size_t _f32_to_f64_vector(DICM_UNUSED unsigned char *dst,
+                                 DICM_UNUSED const unsigned char *src,
+                                 DICM_UNUSED size_t n) {
+  return 0;
+}
+#endif
+
+/* one element, memcpy keeps it free of alignment and aliasing issues */
+static double _load_double(const unsigned char *src, int from) {
+  switch (from) {
+    case DICM_VALUE_UINT16: {
+      uint16_t v;
+      memcpy(&v, src, sizeof v);
+      return v;
+    }
+    case DICM_VALUE_INT16: {
+      int16_t v;
+      memcpy(&v, src, sizeof v);
+      return v;
+    }
+    case DICM_VALUE_UINT32: {
+      uint32_t v;
+      memcpy(&v, src, sizeof v);
+      return v;
+    }
+    case DICM_VALUE_INT32: {
+      int32_t v;
+      memcpy(&v, src, sizeof v);
+      return v;
+    }
+  }
+  float v;
+  memcpy(&v, src, sizeof v);
+  return (double)v;
+}
+
+void widen_values(void *buf, size_t n, const int from, const int to) {
+  assert(value_type_widens(from, to));
+  if (from == to) return;
+  const size_t from_size = value_type_size(from);
+  const size_t to_size = value_type_size(to);
+  unsigned char *dst = buf;
+  const unsigned char *src = dst + n * (to_size - from_size);
+  size_t i;
+  if (to == DICM_VALUE_INT32) {
+    i = from == DICM_VALUE_UINT16 ? _u16_to_i32_vector(dst, src, n)
+                                  : _i16_to_i32_vector(dst, src, n);
+    for (; i < n; ++i) {
+      int32_t v;
+      if (from == DICM_VALUE_UINT16) {
+        uint16_t u;
+        memcpy(&u, src + 2 * i, sizeof u);
+        v = u;
+      } else {
+        int16_t s;
+        memcpy(&s, src + 2 * i, sizeof s);
+        v = s;
+      }
+      memcpy(dst + 4 * i, &v, sizeof v);
+    }
+    return;
+  }
+  i = from == DICM_VALUE_FLOAT32 ? _f32_to_f64_vector(dst, src, n) : 0;
+  for (; i < n; ++i) {
+    const double v = _load_double(src + from_size * i, from);
+    memcpy(dst + 8 * i, &v, sizeof v);
+  }
+}
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: LGPLv3 */
+#pragma once
+
+#include "dicm-public.h"
+#include "dicm-reader.h"
+
+#include <stdbool.h>
+#include <stddef.h> /* size_t */
+
+/* host type of the elements of a binary value, -1 for other VRs */
+static inline int vr_value_type(const dicm_vr_t vr) {
+  switch (vr) {
+    case VR_OW:
+    case VR_US:
+      return DICM_VALUE_UINT16;
+    case VR_SS:
+      return DICM_VALUE_INT16;
+    case VR_OL:
+    case VR_UL:
+      return DICM_VALUE_UINT32;
+    case VR_SL:
+      return DICM_VALUE_INT32;
+    case VR_FL:
+    case VR_OF:
+      return DICM_VALUE_FLOAT32;
+    case VR_FD:
+    case VR_OD:
+      return DICM_VALUE_FLOAT64;
+  }
+  return -1;
+}
+
+static inline size_t value_type_size(const int type) {
+  switch (type) {
+    case DICM_VALUE_UINT16:
+    case DICM_VALUE_INT16:
+      return 2;
+    case DICM_VALUE_UINT32:
+    case DICM_VALUE_INT32:
+    case DICM_VALUE_FLOAT32:
+      return 4;
+  }
+  return 8;
+}
+
+/* the conversions of widen_values: to the same type, 16-bit integers to
+ * int32, and anything but 64-bit floats to double, all exact */
+bool value_type_widens(int from, int to);
+
+/* convert in place the n elements of type from stored at the end of buf, at
+ * n * (value_type_size(to) - value_type_size(from)), to n elements of type to
+ * from the start of buf. Vector registers are used for the common cases
+ * (US/SS to int32, FL to double) where available */
+void widen_values(void *buf, size_t n, int from, int to);
@@ -0,0 +1,249 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "dicm-deflate.h"
+
+#include <errno.h>
+
+#ifdef DICM_HAVE_ZLIB
+
+#include <limits.h> /* UINT_MAX */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ZLIB_CONST
+#include <zlib.h>
+
+/* compressed side, and scratch space of skip */
+enum { DEFLATE_BUFFER_SIZE = 64 * 1024 };
+
+struct _deflate {
+  struct dicm_io io;
+  struct dicm_io *inner;
+  z_stream zs;
+  bool writing;
+  /* end of the compressed stream was reached */
+  bool end;
+  unsigned char *buffer;
+  size_t buffer_size;
+  unsigned char *scratch;
+  /* uncompressed bytes read or written so far */
+  io_offset pos;
+};
+
+static DICM_CHECK_RETURN int _deflate_destroy(void *self_) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _deflate_read(void *self_, void *buf,
+                                                size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN io_offset _deflate_skip(void *self_,
+                                                 io_offset off) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _deflate_write(void *self_, void const *buf,
+                                                 size_t size) DICM_NONNULL;
+
+static struct io_vtable const g_vtable = {
+    /* object interface */
+    .object = {.fp_destroy = _deflate_destroy},
+    /* io interface */
+    .io = {.fp_read = _deflate_read,
+           .fp_skip = _deflate_skip,
+           .fp_write = _deflate_write}};
+
+/* zlib window bits: negative for raw deflate, +16 for a gzip header, +32 to
+ * accept either a gzip or a zlib header */
+static int _window_bits(int format, bool writing) {
+  if (format == DICM_DEFLATE_RAW) return -MAX_WBITS;
+  return MAX_WBITS + (writing ? 16 : 32);
+}
+
+static struct _deflate *_deflate_new(struct dicm_io *io, size_t buffer_size) {
+  struct _deflate *self = (struct _deflate *)calloc(1, sizeof(*self));
+  if (!self) return NULL;
+  self->io.vtable = &g_vtable;
+  self->inner = io;
+  self->buffer_size = buffer_size;
+  self->buffer = malloc(buffer_size);
+  if (!self->buffer) {
+    free(self);
+    return NULL;
+  }
+  return self;
+}
+
+int inflate_io_create(struct dicm_io **pself, struct dicm_io *io, int format,
+                      const void *input, size_t size) {
+  *pself = NULL;
+  if (format != DICM_DEFLATE_RAW && format != DICM_DEFLATE_GZIP) return EINVAL;
+  struct _deflate *self = _deflate_new(
+      io, size > DEFLATE_BUFFER_SIZE ? size : DEFLATE_BUFFER_SIZE);
+  if (!self) return ENOMEM;
+  if (size) memcpy(self->buffer, input, size);
+  self->zs.next_in = self->buffer;
+  self->zs.avail_in = (uInt)size;
+  if (inflateInit2(&self->zs, _window_bits(format, false)) != Z_OK) {
+    free(self->buffer);
+    free(self);
+    return ENOMEM;
+  }
+  *pself = &self->io;
+  return 0;
+}
+
+int dicm_io_deflate_create(struct dicm_io **pself, struct dicm_io *io,
+                           int io_mode, int format, int level) {
+  if (io_mode == DICM_IO_READ) {
+    return inflate_io_create(pself, io, format, NULL, 0);
+  }
+  *pself = NULL;
+  if (io_mode != DICM_IO_WRITE) return EINVAL;
+  if (format != DICM_DEFLATE_RAW && format != DICM_DEFLATE_GZIP) return EINVAL;
+  if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+    return EINVAL;
+  }
+  struct _deflate *self = _deflate_new(io, DEFLATE_BUFFER_SIZE);
+  if (!self) return ENOMEM;
+  self->writing = true;
+  if (deflateInit2(&self->zs, level, Z_DEFLATED, _window_bits(format, true),
+                   8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    free(self->buffer);
+    free(self);
+    return ENOMEM;
+  }
+  self->zs.next_out = self->buffer;
+  self->zs.avail_out = DEFLATE_BUFFER_SIZE;
+  *pself = &self->io;
+  return 0;
+}
+
+/* pass the compressed bytes on to inner */
+static int _deflate_flush(struct _deflate *self) {
+  const size_t size = self->buffer_size - self->zs.avail_out;
+  size_t done = 0;
+  while (done != size) {
+    const io_ssize n =
+        dicm_io_write(self->inner, self->buffer + done, size - done);
+    if (n <= 0) return 1;
+    done += (size_t)n;
+  }
+  self->zs.next_out = self->buffer;
+  self->zs.avail_out = (uInt)self->buffer_size;
+  return 0;
+}
+
+/* a write adapter finishes the stream, inner is left open */
+int _deflate_destroy(void *self_) {
+  struct _deflate *self = (struct _deflate *)self_;
+  int res = 0;
+  if (self->writing) {
+    int ret;
+    do {
+      ret = deflate(&self->zs, Z_FINISH);
+      if (ret == Z_STREAM_ERROR || _deflate_flush(self)) {
+        res = 1;
+        break;
+      }
+    } while (ret != Z_STREAM_END);
+    deflateEnd(&self->zs);
+  } else {
+    inflateEnd(&self->zs);
+  }
+  free(self->scratch);
+  free(self->buffer);
+  free(self);
+  return res;
+}
+
+io_ssize _deflate_read(void *self_, void *buf, size_t size) {
+  struct _deflate *self = (struct _deflate *)self_;
+  if (self->writing) return -1;
+  if (size > UINT_MAX) size = UINT_MAX;
+  self->zs.next_out = buf;
+  self->zs.avail_out = (uInt)size;
+  while (self->zs.avail_out && !self->end) {
+    if (self->zs.avail_in == 0) {
+      const io_ssize n =
+          dicm_io_read(self->inner, self->buffer, self->buffer_size);
+      if (n < 0) return -1;
+      /* truncated stream, reported as end of file */
+      if (n == 0) break;
+      self->zs.next_in = self->buffer;
+      self->zs.avail_in = (uInt)n;
+    }
+    const int ret = inflate(&self->zs, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      self->end = true;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      return -1;
+    }
+  }
+  const size_t read = size - self->zs.avail_out;
+  self->pos += (io_offset)read;
+  return (io_ssize)read;
+}
+
+/* inflate and drop */
+io_offset _deflate_skip(void *self_, io_offset off) {
+  struct _deflate *self = (struct _deflate *)self_;
+  if (self->writing || off < 0) return -1;
+  if (!self->scratch) {
+    self->scratch = malloc(DEFLATE_BUFFER_SIZE);
+    if (!self->scratch) return -1;
+  }
+  while (off) {
+    const size_t size =
+        off < DEFLATE_BUFFER_SIZE ? (size_t)off : DEFLATE_BUFFER_SIZE;
+    const io_ssize n = _deflate_read(self, self->scratch, size);
+    if (n <= 0) return -1;
+    off -= n;
+  }
+  return self->pos;
+}
+
+io_ssize _deflate_write(void *self_, void const *buf, size_t size) {
+  struct _deflate *self = (struct _deflate *)self_;
+  if (!self->writing) return -1;
+  if (size > UINT_MAX) size = UINT_MAX;
+  self->zs.next_in = buf;
+  self->zs.avail_in = (uInt)size;
+  while (self->zs.avail_in) {
+    if (deflate(&self->zs, Z_NO_FLUSH) == Z_STREAM_ERROR) return -1;
+    if (self->zs.avail_out == 0 && _deflate_flush(self)) return -1;
+  }
+  self->pos += (io_offset)size;
+  return (io_ssize)size;
+}
+
+#else
+
+int inflate_io_create(struct dicm_io **pself, DICM_UNUSED struct dicm_io *io,
+                      DICM_UNUSED int format, DICM_UNUSED const void *input,
+                      DICM_UNUSED size_t size) {
+  *pself = NULL;
+  return ENOSYS;
+}
+
+int dicm_io_deflate_create(struct dicm_io **pself,
+                           DICM_UNUSED struct dicm_io *io,
+                           DICM_UNUSED int io_mode, DICM_UNUSED int format,
+                           DICM_UNUSED int level) {
+  *pself = NULL;
+  return ENOSYS;
+}
+
+#endif
@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: LGPLv3 */
+#pragma once
+
+#include "dicm-io.h"
+
+#include <stddef.h> /* size_t */
+
+/* read side of dicm_io_deflate_create, the first size bytes of the stream
+ * being already read from io into input (read-ahead). Returns ENOSYS when
+ * built without zlib */
+DICM_CHECK_RETURN int inflate_io_create(struct dicm_io **pself,
+                                        struct dicm_io *io, int format,
+                                        const void *input,
+                                        size_t size) DICM_NONNULL2(1, 2);
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: LGPLv3 */
+#pragma once
+
+#include <stdint.h> /* uint32_t */
+
+/* perfect hash of the data dictionary subset in dicm-dict.def, generated at
+ * build time by dicm-gendict into dicm-dict-table.h. A tag hashes to a bucket,
+ * and the displacement of the bucket sends it to a slot of its own: a lookup
+ * is two multiplications and one comparison */
+struct dict_entry {
+  uint32_t tag;
+  uint32_t vr;
+};
+
+static inline uint32_t dict_bucket(const uint32_t tag, const uint32_t seed,
+                                   const unsigned int bits) {
+  return ((tag ^ seed) * UINT32_C(0x9E3779B1)) >> (32u - bits);
+}
+
+static inline uint32_t dict_slot(const uint32_t tag, const uint32_t seed,
+                                 const unsigned int bits,
+                                 const uint32_t displacement) {
+  return (((tag ^ seed) * UINT32_C(0x85EBCA6B)) >> (32u - bits)) ^
+         displacement;
+}
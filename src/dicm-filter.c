@@ -0,0 +1,359 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "dicm-filter.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+enum { FILTER_NONE = UINT32_MAX, FILTER_ROOT = 0 };
+
+static const uint64_t empty_key = UINT64_MAX;
+
+struct _filter_attr {
+  /* dataset or item holding the attribute */
+  uint32_t level;
+  dicm_tag_t tag;
+  /* a path ends here, everything below is kept */
+  bool all;
+};
+
+struct _filter_item {
+  uint32_t attr;
+  /* item number, or DICM_ANY_ITEM */
+  uint32_t item;
+  uint32_t level;
+};
+
+struct _filter_slot {
+  uint64_t key;
+  uint32_t value;
+};
+
+/* a kept sequence, on the way to a requested attribute */
+struct _filter_frame {
+  uint32_t attr;
+  /* number of items seen so far */
+  uint32_t item;
+  /* level holding attr */
+  uint32_t parent;
+};
+
+struct dicm_filter {
+  /* trie */
+  struct _filter_attr *attrs;
+  uint32_t nattrs;
+  struct _filter_item *items;
+  uint32_t nitems;
+  uint32_t nlevels;
+  struct _filter_slot *slots;
+  unsigned int slot_bits;
+  size_t nslots_used;
+
+  /* walk */
+  uint32_t level;
+  struct _filter_frame *frames;
+  size_t nframes;
+  /* subtree emitted or suppressed as a whole, depth counts nested items and
+   * sequences */
+  bool in_subtree;
+  bool subtree_emit;
+  int depth;
+};
+
+static inline uint64_t _attr_key(uint32_t level, dicm_tag_t tag) {
+  return (uint64_t)level << 32u | tag;
+}
+
+static inline uint64_t _item_key(uint32_t attr, uint32_t item) {
+  return (uint64_t)1 << 63u | (uint64_t)attr << 32u | item;
+}
+
+static inline size_t _slot_index(const struct dicm_filter *self,
+                                 uint64_t key) {
+  /* fibonacci hashing */
+  return (size_t)((key * UINT64_C(0x9E3779B97F4A7C15)) >>
+                  (64u - self->slot_bits));
+}
+
+static uint32_t _lookup(const struct dicm_filter *self, uint64_t key) {
+  const size_t mask = ((size_t)1 << self->slot_bits) - 1;
+  for (size_t i = _slot_index(self, key);; i = (i + 1) & mask) {
+    const struct _filter_slot *slot = &self->slots[i];
+    if (slot->key == key) return slot->value;
+    if (slot->key == empty_key) return FILTER_NONE;
+  }
+}
+
+static int _insert(struct dicm_filter *self, uint64_t key, uint32_t value);
+
+static int _grow(struct dicm_filter *self) {
+  struct _filter_slot *slots = self->slots;
+  const size_t nslots = (size_t)1 << self->slot_bits;
+  const unsigned int slot_bits = self->slot_bits + 1;
+  struct _filter_slot *new_slots =
+      malloc(((size_t)1 << slot_bits) * sizeof *new_slots);
+  if (!new_slots) return 1;
+  for (size_t i = 0; i < (size_t)1 << slot_bits; ++i) {
+    new_slots[i].key = empty_key;
+  }
+  self->slots = new_slots;
+  self->slot_bits = slot_bits;
+  self->nslots_used = 0;
+  for (size_t i = 0; i < nslots; ++i) {
+    if (slots[i].key != empty_key) {
+      (void)_insert(self, slots[i].key, slots[i].value);
+    }
+  }
+  free(slots);
+  return 0;
+}
+
+int _insert(struct dicm_filter *self, uint64_t key, uint32_t value) {
+  /* keep the load factor under 1/2 */
+  if (2 * (self->nslots_used + 1) > (size_t)1 << self->slot_bits &&
+      _grow(self)) {
+    return 1;
+  }
+  const size_t mask = ((size_t)1 << self->slot_bits) - 1;
+  size_t i = _slot_index(self, key);
+  while (self->slots[i].key != empty_key) i = (i + 1) & mask;
+  self->slots[i].key = key;
+  self->slots[i].value = value;
+  self->nslots_used++;
+  return 0;
+}
+
+static uint32_t _add_attr(struct dicm_filter *self, uint32_t level,
+                          dicm_tag_t tag) {
+  const uint64_t key = _attr_key(level, tag);
+  const uint32_t found = _lookup(self, key);
+  if (found != FILTER_NONE) return found;
+  struct _filter_attr *attrs =
+      realloc(self->attrs, (self->nattrs + 1) * sizeof *attrs);
+  if (!attrs) return FILTER_NONE;
+  self->attrs = attrs;
+  const uint32_t attr = self->nattrs;
+  if (_insert(self, key, attr)) return FILTER_NONE;
+  attrs[attr].level = level;
+  attrs[attr].tag = tag;
+  attrs[attr].all = false;
+  self->nattrs++;
+  return attr;
+}
+
+static uint32_t _add_item(struct dicm_filter *self, uint32_t attr,
+                          uint32_t item) {
+  const uint64_t key = _item_key(attr, item);
+  const uint32_t found = _lookup(self, key);
+  if (found != FILTER_NONE) return found;
+  struct _filter_item *items =
+      realloc(self->items, (self->nitems + 1) * sizeof *items);
+  if (!items) return FILTER_NONE;
+  self->items = items;
+  const uint32_t level = self->nlevels;
+  if (_insert(self, key, level)) return FILTER_NONE;
+  items[self->nitems].attr = attr;
+  items[self->nitems].item = item;
+  items[self->nitems].level = level;
+  self->nitems++;
+  self->nlevels++;
+  return level;
+}
+
+/* copy the subtree at src into dst, return 1 on failure */
+static int _merge(struct dicm_filter *self, uint32_t src, uint32_t dst,
+                  bool *changed) {
+  /* entries appended while merging are never at level src */
+  for (uint32_t a = 0; a < self->nattrs; ++a) {
+    if (self->attrs[a].level != src) continue;
+    const uint32_t nattrs = self->nattrs;
+    const uint32_t d = _add_attr(self, dst, self->attrs[a].tag);
+    if (d == FILTER_NONE) return 1;
+    if (d == nattrs) *changed = true;
+    if (self->attrs[a].all && !self->attrs[d].all) {
+      self->attrs[d].all = true;
+      *changed = true;
+    }
+    for (uint32_t i = 0; i < self->nitems; ++i) {
+      if (self->items[i].attr != a) continue;
+      const uint32_t nlevels = self->nlevels;
+      const uint32_t level = _add_item(self, d, self->items[i].item);
+      if (level == FILTER_NONE) return 1;
+      if (level == nlevels) *changed = true;
+      if (_merge(self, self->items[i].level, level, changed)) return 1;
+    }
+  }
+  return 0;
+}
+
+/* make every numbered item also hold what any item holds */
+static int _merge_any_items(struct dicm_filter *self) {
+  bool changed;
+  do {
+    changed = false;
+    for (uint32_t i = 0; i < self->nitems; ++i) {
+      if (self->items[i].item == DICM_ANY_ITEM) continue;
+      const uint32_t any =
+          _lookup(self, _item_key(self->items[i].attr, DICM_ANY_ITEM));
+      if (any == FILTER_NONE) continue;
+      if (_merge(self, any, self->items[i].level, &changed)) return 1;
+    }
+  } while (changed);
+  return 0;
+}
+
+static int _add_path(struct dicm_filter *self,
+                     const struct dicm_tag_path *path) {
+  if (path->size == 0) return 1;
+  uint32_t level = FILTER_ROOT;
+  for (size_t s = 0; s < path->size; ++s) {
+    const struct dicm_path_step *step = &path->steps[s];
+    const uint32_t attr = _add_attr(self, level, step->tag);
+    if (attr == FILTER_NONE) return 1;
+    if (s + 1 == path->size) {
+      self->attrs[attr].all = true;
+    } else {
+      level = _add_item(self, attr, step->item);
+      if (level == FILTER_NONE) return 1;
+    }
+  }
+  return 0;
+}
+
+int filter_create(struct dicm_filter **pself,
+                  const struct dicm_tag_path *paths, size_t npaths) {
+  struct dicm_filter *self = calloc(1, sizeof *self);
+  if (!self) return 1;
+  self->nlevels = 1; /* root */
+  self->slot_bits = 6;
+  self->slots = malloc(((size_t)1 << self->slot_bits) * sizeof *self->slots);
+  size_t max_size = 0;
+  for (size_t p = 0; p < npaths; ++p) {
+    if (paths[p].size > max_size) max_size = paths[p].size;
+  }
+  /* one frame per kept sequence, at most one per step */
+  self->frames = malloc((max_size ? max_size : 1) * sizeof *self->frames);
+  if (!self->slots || !self->frames) {
+    filter_free(self);
+    return 1;
+  }
+  for (size_t i = 0; i < (size_t)1 << self->slot_bits; ++i) {
+    self->slots[i].key = empty_key;
+  }
+  for (size_t p = 0; p < npaths; ++p) {
+    if (_add_path(self, &paths[p])) {
+      filter_free(self);
+      return 1;
+    }
+  }
+  if (_merge_any_items(self)) {
+    filter_free(self);
+    return 1;
+  }
+  self->level = FILTER_ROOT;
+  *pself = self;
+  return 0;
+}
+
+void filter_free(struct dicm_filter *self) {
+  free(self->attrs);
+  free(self->items);
+  free(self->slots);
+  free(self->frames);
+  free(self);
+}
+
+static inline void _start_subtree(struct dicm_filter *self, bool emit,
+                                  int depth) {
+  self->in_subtree = true;
+  self->subtree_emit = emit;
+  self->depth = depth;
+}
+
+/* events of a subtree taken or left as a whole. An attribute subtree (depth
+ * 0) ends with its value or its sequence, an item subtree (depth 1) with its
+ * end */
+static enum filter_action _subtree_next(struct dicm_filter *self, int event) {
+  switch (event) {
+    case EVENT_START_ITEM:
+    case EVENT_START_SEQUENCE:
+      self->depth++;
+      break;
+    case EVENT_END_ITEM:
+    case EVENT_END_SEQUENCE:
+      if (--self->depth == 0) self->in_subtree = false;
+      break;
+    case EVENT_VALUE:
+      if (self->depth == 0) self->in_subtree = false;
+      break;
+    default:;
+  }
+  return self->subtree_emit ? FILTER_EMIT : FILTER_SUPPRESS;
+}
+
+enum filter_action filter_next(struct dicm_filter *self, int event,
+                               const struct dicm_attribute *da) {
+  if (self->in_subtree) return _subtree_next(self, event);
+  switch (event) {
+    case EVENT_ATTRIBUTE: {
+      const uint32_t attr = _lookup(self, _attr_key(self->level, da->tag));
+      if (attr == FILTER_NONE) {
+        if (!dicm_vl_is_undefined(da->vl)) return FILTER_SEEK;
+        _start_subtree(self, false, 0);
+        return FILTER_SUPPRESS;
+      }
+      if (self->attrs[attr].all || da->vr != VR_SQ) {
+        _start_subtree(self, true, 0);
+        return FILTER_EMIT;
+      }
+      /* on the way to a requested attribute */
+      struct _filter_frame *frame = &self->frames[self->nframes++];
+      frame->attr = attr;
+      frame->item = 0;
+      frame->parent = self->level;
+    } break;
+    case EVENT_START_ITEM: {
+      assert(self->nframes);
+      struct _filter_frame *frame = &self->frames[self->nframes - 1];
+      frame->item++;
+      uint32_t level = _lookup(self, _item_key(frame->attr, frame->item));
+      if (level == FILTER_NONE) {
+        level = _lookup(self, _item_key(frame->attr, DICM_ANY_ITEM));
+      }
+      if (level == FILTER_NONE) {
+        if (!dicm_vl_is_undefined(da->vl)) return FILTER_SEEK;
+        _start_subtree(self, false, 1);
+        return FILTER_SUPPRESS;
+      }
+      self->level = level;
+    } break;
+    case EVENT_END_ITEM:
+      assert(self->nframes);
+      self->level = self->frames[self->nframes - 1].parent;
+      break;
+    case EVENT_END_SEQUENCE:
+      assert(self->nframes);
+      self->level = self->frames[--self->nframes].parent;
+      break;
+    default:;
+  }
+  return FILTER_EMIT;
+}
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: LGPLv3 */
+#pragma once
+
+#include "dicm-public.h"
+#include "dicm-reader.h"
+
+#include <stdbool.h>
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uint32_t */
+
+/* tag paths compiled into a trie: a level is a dataset or an item, its
+ * attributes are looked up by (level, tag) and the items of a sequence by
+ * (attribute, item number), both in one open addressing hash table. Items
+ * selected with DICM_ANY_ITEM are merged into the explicitly numbered ones at
+ * compile time, so that one lookup is enough at run time.
+ * The filter also tracks where the reader is in the trie. */
+struct dicm_filter;
+
+/* what the reader should do with the current event */
+enum filter_action {
+  FILTER_EMIT = 0,
+  FILTER_SUPPRESS,
+  /* attribute or item of defined length to be left out: seek past it */
+  FILTER_SEEK
+};
+
+DICM_CHECK_RETURN int filter_create(struct dicm_filter **pself,
+                                    const struct dicm_tag_path *paths,
+                                    size_t npaths) DICM_NONNULL;
+
+void filter_free(struct dicm_filter *self);
+
+/* walk the trie along the events of the reader */
+enum filter_action filter_next(struct dicm_filter *self, int event,
+                               const struct dicm_attribute *da) DICM_NONNULL;
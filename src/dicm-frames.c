@@ -0,0 +1,634 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "dicm-frames.h"
+
+#include "dicm-item.h"
+#include "dicm-private.h"
+#include "dicm-swap.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  TAG_SAMPLESPERPIXEL = MAKE_TAG(0x0028, 0x0002),
+  TAG_NUMBEROFFRAMES = MAKE_TAG(0x0028, 0x0008),
+  TAG_ROWS = MAKE_TAG(0x0028, 0x0010),
+  TAG_COLUMNS = MAKE_TAG(0x0028, 0x0011),
+  TAG_BITSALLOCATED = MAKE_TAG(0x0028, 0x0100),
+  TAG_EXTENDEDOFFSETTABLE = MAKE_TAG(0x7fe0, 0x0001),
+  TAG_EXTENDEDOFFSETTABLELENGTHS = MAKE_TAG(0x7fe0, 0x0002)
+};
+
+struct dicm_frames {
+  /* io of the reader, and where its cursor is */
+  struct dicm_io *io;
+  io_offset pos;
+  bool big_endian;
+  bool encapsulated;
+  size_t nframes;
+  /* native: where the value starts, bits per frame, and the width of the
+   * words swapped to little endian (0 when none) */
+  io_offset value;
+  uint64_t frame_bits;
+  size_t swap_width;
+  /* encapsulated, with an offset table: item header of the first fragment of
+   * each frame, and the length of its only fragment when known */
+  io_offset *starts;
+  uint64_t *lengths;
+  /* encapsulated, without: every fragment, those of frame k start at
+   * fragments[first[k]] */
+  struct dicm_fragment_range *fragments;
+  size_t nfragments;
+  size_t *first;
+  /* reused from one gathered frame to the next */
+  struct dicm_fragment_range *ranges;
+  size_t ranges_capacity;
+  struct dicm_iovec *iov;
+  size_t iov_capacity;
+  unsigned char *buffer;
+  size_t buffer_capacity;
+  /* sink of the item headers between fragments */
+  unsigned char header[8];
+};
+
+static int _grow(void **data, size_t *capacity, size_t needed, size_t size) {
+  if (needed <= *capacity) return 0;
+  size_t capacity_ = *capacity ? *capacity : 16;
+  while (capacity_ < needed) capacity_ *= 2;
+  void *p = realloc(*data, capacity_ * size);
+  if (!p) return 1;
+  *data = p;
+  *capacity = capacity_;
+  return 0;
+}
+
+static int _next_event(struct _dicm_utf8_reader *reader) {
+  const int next = dicm_reader_next_event(&reader->reader);
+  /* offsets would be in the inflated stream */
+  return reader->inflate ? -1 : next;
+}
+
+/* the whole value of the current attribute, malloc'ed */
+static int _read_value(struct _dicm_utf8_reader *reader, void **value,
+                       size_t *size) {
+  if (_next_event(reader) != EVENT_VALUE) return 1;
+  const size_t vl = array_back(&reader->item_readers)->da.vl;
+  void *buf = malloc(vl ? vl : 1);
+  if (!buf) return 1;
+  if (vl && dicm_reader_read_value(&reader->reader, buf, vl)) {
+    free(buf);
+    return 1;
+  }
+  free(*value);
+  *value = buf;
+  *size = vl;
+  return 0;
+}
+
+/* IS value, without padding */
+static int _parse_count(const char *value, size_t size, size_t *count) {
+  size_t n = 0;
+  size_t digits = 0;
+  for (size_t i = 0; i < size; ++i) {
+    const char c = value[i];
+    if (c >= '0' && c <= '9') {
+      if (n > SIZE_MAX / 10 - 1) return 1;
+      n = n * 10 + (size_t)(c - '0');
+      digits++;
+    } else if (c != ' ' && c != '+') {
+      return 1;
+    }
+  }
+  if (!digits) return 1;
+  *count = n;
+  return 0;
+}
+
+/* the root attributes needed to locate frames, up to the Pixel Data */
+struct _frames_header {
+  size_t nframes;
+  uint16_t rows;
+  uint16_t columns;
+  uint16_t bits_allocated;
+  uint16_t samples_per_pixel;
+  uint64_t *eot;
+  size_t eot_size;
+  uint64_t *eot_lengths;
+  size_t eot_lengths_size;
+};
+
+static int _walk_header(struct _dicm_utf8_reader *reader,
+                        struct _frames_header *h, struct dicm_attribute *pd) {
+  void *value = NULL;
+  size_t size = 0;
+  for (;;) {
+    const int next = _next_event(reader);
+    if (next < 0 || next == EVENT_END_DATASET) break;
+    if (next != EVENT_ATTRIBUTE) continue;
+    const struct dicm_attribute *da = &array_back(&reader->item_readers)->da;
+    if (da->tag == TAG_PIXELDATA) {
+      *pd = *da;
+      free(value);
+      return 0;
+    }
+    if (da->vr == VR_SQ) {
+      if (dicm_reader_skip_subtree(&reader->reader)) break;
+    } else if (da->tag == TAG_NUMBEROFFRAMES) {
+      if (_read_value(reader, &value, &size) ||
+          _parse_count(value, size, &h->nframes)) {
+        break;
+      }
+    } else if (da->tag == TAG_ROWS || da->tag == TAG_COLUMNS ||
+               da->tag == TAG_BITSALLOCATED ||
+               da->tag == TAG_SAMPLESPERPIXEL) {
+      uint16_t *us = da->tag == TAG_ROWS             ? &h->rows
+                     : da->tag == TAG_COLUMNS        ? &h->columns
+                     : da->tag == TAG_BITSALLOCATED ? &h->bits_allocated
+                                                     : &h->samples_per_pixel;
+      if (da->vl != 2 || _next_event(reader) != EVENT_VALUE ||
+          dicm_reader_read_value(&reader->reader, us, 2)) {
+        break;
+      }
+    } else if (da->tag == TAG_EXTENDEDOFFSETTABLE) {
+      if (da->vl % 8 || _read_value(reader, (void **)&h->eot, &size)) break;
+      h->eot_size = size / 8;
+    } else if (da->tag == TAG_EXTENDEDOFFSETTABLELENGTHS) {
+      if (da->vl % 8 || _read_value(reader, (void **)&h->eot_lengths, &size)) {
+        break;
+      }
+      h->eot_lengths_size = size / 8;
+    }
+  }
+  free(value);
+  return 1;
+}
+
+/* fragment headers, the values are skipped */
+static int _scan_fragments(struct dicm_frames *self,
+                           struct _dicm_utf8_reader *reader) {
+  size_t capacity = 0;
+  for (;;) {
+    const int next = _next_event(reader);
+    if (next == EVENT_END_SEQUENCE) return 0;
+    if (next == EVENT_VALUE) continue;
+    if (next != EVENT_FRAGMENT) return 1;
+    if (_grow((void **)&self->fragments, &capacity, self->nfragments + 1,
+              sizeof *self->fragments)) {
+      return 1;
+    }
+    struct dicm_fragment_range *f = &self->fragments[self->nfragments++];
+    f->offset = src_tell(&reader->src);
+    f->length = array_back(&reader->item_readers)->da.vl;
+  }
+}
+
+/* one frame per fragment, or a single frame */
+static int _map_fragments(struct dicm_frames *self) {
+  const size_t n = self->nfragments;
+  if (self->nframes != n && self->nframes != 1) return 1;
+  self->first = malloc((self->nframes + 1) * sizeof *self->first);
+  if (!self->first) return 1;
+  for (size_t k = 0; k < self->nframes; ++k) {
+    self->first[k] = self->nframes == 1 ? 0 : k;
+  }
+  self->first[self->nframes] = n;
+  return 0;
+}
+
+static int _set_starts(struct dicm_frames *self, io_offset first_fragment,
+                       const uint64_t *offsets, size_t n, size_t width) {
+  self->starts = malloc(n * sizeof *self->starts);
+  if (!self->starts) return 1;
+  for (size_t k = 0; k < n; ++k) {
+    uint64_t off;
+    if (width == 8) {
+      off = offsets[k];
+    } else {
+      uint32_t off32;
+      memcpy(&off32, (const char *)offsets + 4 * k, 4);
+      off = off32;
+    }
+    /* increasing, as frames are stored in order */
+    if (off > INT64_MAX - (uint64_t)first_fragment ||
+        (k && first_fragment + (io_offset)off <= self->starts[k - 1])) {
+      return 1;
+    }
+    self->starts[k] = first_fragment + (io_offset)off;
+  }
+  return 0;
+}
+
+static int _locate_fragments(struct dicm_frames *self,
+                             struct _dicm_utf8_reader *reader,
+                             struct _frames_header *h) {
+  /* Basic Offset Table, the first item */
+  if (_next_event(reader) != EVENT_START_SEQUENCE ||
+      _next_event(reader) != EVENT_FRAGMENT) {
+    return 1;
+  }
+  void *bot = NULL;
+  size_t bot_size = 0;
+  if (_read_value(reader, &bot, &bot_size) || bot_size % 4) {
+    free(bot);
+    return 1;
+  }
+  const io_offset first_fragment = src_tell(&reader->src);
+  int res;
+  if (h->eot_size) {
+    res = (h->nframes && h->nframes != h->eot_size) ||
+          (h->eot_lengths_size && h->eot_lengths_size != h->eot_size);
+    self->nframes = h->eot_size;
+    res = res || _set_starts(self, first_fragment, h->eot, h->eot_size, 8);
+    if (!res && h->eot_lengths_size) {
+      self->lengths = h->eot_lengths;
+      h->eot_lengths = NULL;
+    }
+  } else if (bot_size) {
+    self->nframes = bot_size / 4;
+    res = (h->nframes && h->nframes != self->nframes) ||
+          _set_starts(self, first_fragment, bot, self->nframes, 4);
+  } else {
+    self->nframes = h->nframes ? h->nframes : 1;
+    res = _scan_fragments(self, reader) || _map_fragments(self);
+  }
+  free(bot);
+  return res;
+}
+
+/* frames of a defined length value, packed back to back: bit-packed frames
+ * (Bits Allocated 1) may start in the middle of a byte */
+static int _locate_native(struct dicm_frames *self,
+                          struct _dicm_utf8_reader *reader,
+                          const struct _frames_header *h,
+                          const struct dicm_attribute *pd) {
+  const uint64_t samples = h->samples_per_pixel ? h->samples_per_pixel : 1;
+  self->nframes = h->nframes ? h->nframes : 1;
+  self->value = src_tell(&reader->src);
+  self->frame_bits = (uint64_t)h->rows * h->columns * samples;
+  /* Bits Allocated is at most 64 */
+  if (!self->frame_bits || !h->bits_allocated || h->bits_allocated > 64 ||
+      (h->bits_allocated != 1 && h->bits_allocated % 8)) {
+    return 1;
+  }
+  self->frame_bits *= h->bits_allocated;
+  if (self->frame_bits > (uint64_t)pd->vl * 8 / self->nframes) return 1;
+  if (array_at(&reader->item_readers, 0)->encoding == DICM_VR_EXPLICIT_BE) {
+    self->swap_width = vr_swap_width(pd->vr);
+    /* frames must hold whole words, bits of swapped words would not be in
+     * frame order */
+    if (self->swap_width &&
+        (h->bits_allocated == 1 || self->frame_bits / 8 % self->swap_width)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int dicm_frames_create(struct dicm_frames **pself,
+                       struct dicm_reader *reader_) {
+  *pself = NULL;
+  struct _dicm_utf8_reader *reader = (struct _dicm_utf8_reader *)reader_;
+  if (reader->current_state != STATE_INIT) return 1;
+  struct dicm_frames *self = calloc(1, sizeof *self);
+  if (!self) return 1;
+  struct _frames_header h = {0};
+  struct dicm_attribute pd;
+  int res = _walk_header(reader, &h, &pd);
+  if (!res) {
+    self->big_endian =
+        array_at(&reader->item_readers, 0)->encoding == DICM_VR_EXPLICIT_BE;
+    self->encapsulated = pd.vl == VL_UNDEFINED;
+    if (self->encapsulated) {
+      res = _locate_fragments(self, reader, &h);
+    } else {
+      res = _locate_native(self, reader, &h, &pd);
+    }
+  }
+  free(h.eot);
+  free(h.eot_lengths);
+  if (res) {
+    dicm_frames_destroy(self);
+    return 1;
+  }
+  self->io = reader->src.io;
+  self->pos = reader->src.offset;
+  *pself = self;
+  return 0;
+}
+
+int dicm_frames_destroy(struct dicm_frames *self) {
+  free(self->starts);
+  free(self->lengths);
+  free(self->fragments);
+  free(self->first);
+  free(self->ranges);
+  free(self->iov);
+  free(self->buffer);
+  free(self);
+  return 0;
+}
+
+size_t dicm_frames_get_count(const struct dicm_frames *self) {
+  return self->nframes;
+}
+
+size_t dicm_frames_get_frame_size(const struct dicm_frames *self) {
+  return self->encapsulated ? 0 : (size_t)((self->frame_bits + 7) / 8);
+}
+
+static int _seek(struct dicm_frames *self, io_offset offset) {
+  if (offset != self->pos && dicm_io_skip(self->io, offset - self->pos) < 0) {
+    return 1;
+  }
+  self->pos = offset;
+  return 0;
+}
+
+static int _read(struct dicm_frames *self, void *buf, size_t size) {
+  const io_ssize n = dicm_io_read(self->io, buf, size);
+  if (n > 0) self->pos += n;
+  return n != (io_ssize)size;
+}
+
+/* item headers from the start of frame index, up to the start of the next
+ * frame or the sequence delimitation item */
+static int _walk_fragments(struct dicm_frames *self, size_t index,
+                           struct dicm_fragment_range *ranges, size_t size,
+                           size_t *count) {
+  const bool last = index + 1 == self->nframes;
+  const io_offset end = last ? INT64_MAX : self->starts[index + 1];
+  size_t n = 0;
+  if (_seek(self, self->starts[index])) return 1;
+  while (self->pos < end) {
+    union _ude ude;
+    if (_read(self, &ude.ide, 8)) return 1;
+    const uint32_t tag =
+        self->big_endian ? _ide_get_tag_be(&ude) : _ide_get_tag(&ude);
+    const uint32_t vl =
+        self->big_endian ? _ide_get_vl_be(&ude) : _ide_get_vl(&ude);
+    if (tag == TAG_ENDSQITEM && last) break;
+    if (tag != TAG_STARTITEM || vl == VL_UNDEFINED) return 1;
+    if (n < size) {
+      ranges[n].offset = self->pos;
+      ranges[n].length = vl;
+    }
+    n++;
+    if (_seek(self, self->pos + vl)) return 1;
+  }
+  if (self->pos != end && !last) return 1;
+  *count = n;
+  return 0;
+}
+
+int dicm_frames_get_fragments(struct dicm_frames *self, size_t index,
+                              struct dicm_fragment_range *ranges, size_t size,
+                              size_t *count) {
+  if (!self->encapsulated || index >= self->nframes) return 1;
+  if (self->first) {
+    const size_t first = self->first[index];
+    const size_t n = self->first[index + 1] - first;
+    for (size_t i = 0; i < n && i < size; ++i) {
+      ranges[i] = self->fragments[first + i];
+    }
+    *count = n;
+    return 0;
+  }
+  if (self->lengths) {
+    /* one fragment per frame, nothing to read */
+    if (self->lengths[index] > UINT32_MAX) return 1;
+    if (size) {
+      ranges[0].offset = self->starts[index] + 8;
+      ranges[0].length = (size_t)self->lengths[index];
+    }
+    *count = 1;
+    return 0;
+  }
+  return _walk_fragments(self, index, ranges, size, count);
+}
+
+/* bytes holding native frame index, and the bit of the first byte where the
+ * frame starts */
+static void _native_span(const struct dicm_frames *self, size_t index,
+                         io_offset *offset, size_t *length,
+                         unsigned *bit_offset) {
+  const uint64_t first_bit = index * self->frame_bits;
+  *offset = self->value + (io_offset)(first_bit / 8);
+  *bit_offset = (unsigned)(first_bit % 8);
+  *length = (size_t)((*bit_offset + self->frame_bits + 7) / 8);
+}
+
+int dicm_frames_get_range(const struct dicm_frames *self, size_t index,
+                          struct dicm_fragment_range *range,
+                          unsigned *bit_offset) {
+  if (self->encapsulated || index >= self->nframes) return 1;
+  _native_span(self, index, &range->offset, &range->length, bit_offset);
+  return 0;
+}
+
+int dicm_frames_read(struct dicm_frames *self, size_t index, void *buf,
+                     size_t size) {
+  const size_t frame_size = dicm_frames_get_frame_size(self);
+  if (self->encapsulated || index >= self->nframes || size < frame_size) {
+    return 1;
+  }
+  io_offset offset;
+  size_t length;
+  unsigned shift;
+  _native_span(self, index, &offset, &length, &shift);
+  unsigned char *p = buf;
+  /* a frame starting mid-byte ends one byte further */
+  unsigned char extra = 0;
+  if (_seek(self, offset) || _read(self, p, frame_size) ||
+      (length > frame_size && _read(self, &extra, 1))) {
+    return 1;
+  }
+  if (shift) {
+    /* pixels are packed from the least significant bit */
+    for (size_t i = 0; i < frame_size; ++i) {
+      const unsigned next = i + 1 < frame_size ? p[i + 1] : extra;
+      p[i] = (unsigned char)(p[i] >> shift | next << (8u - shift));
+    }
+  }
+  const unsigned tail = (unsigned)(self->frame_bits % 8);
+  if (tail) p[frame_size - 1] &= (unsigned char)((1u << tail) - 1);
+  if (self->swap_width) bswap_words(p, frame_size, self->swap_width);
+  return 0;
+}
+
+int dicm_frames_borrow(struct dicm_frames *self, size_t index,
+                       const void **buf, size_t *size) {
+  io_offset offset;
+  size_t length;
+  unsigned shift;
+  if (self->encapsulated || index >= self->nframes || self->swap_width) {
+    return 1;
+  }
+  _native_span(self, index, &offset, &length, &shift);
+  if (shift || _seek(self, offset)) return 1;
+  const io_ssize n = dicm_io_borrow(self->io, buf, length);
+  if (n > 0) self->pos += n;
+  if (n != (io_ssize)length) return 1;
+  *size = length;
+  return 0;
+}
+
+/* fragments of frame index to self->ranges, their number to n */
+static int _collect(struct dicm_frames *self, size_t index, size_t *n) {
+  if (dicm_frames_get_fragments(self, index, self->ranges,
+                                self->ranges_capacity, n)) {
+    return 1;
+  }
+  if (*n <= self->ranges_capacity) return 0;
+  /* once per frame larger than those before, with an offset table the item
+   * headers are walked again */
+  return _grow((void **)&self->ranges, &self->ranges_capacity, *n,
+               sizeof *self->ranges) ||
+         dicm_frames_get_fragments(self, index, self->ranges,
+                                   self->ranges_capacity, n);
+}
+
+static int _readv(struct dicm_frames *self, const struct dicm_iovec *iov,
+                  size_t n, size_t size) {
+  const io_ssize ret = dicm_io_readv(self->io, iov, n);
+  if (ret > 0) self->pos += ret;
+  return ret != (io_ssize)size;
+}
+
+/* the n fragments of self->ranges to self->buffer, the item headers between
+ * consecutive fragments going to self->header: one read for the whole frame */
+static int _gather(struct dicm_frames *self, size_t n, size_t *size) {
+  size_t total = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (self->ranges[i].length > SIZE_MAX - total) return 1;
+    total += self->ranges[i].length;
+  }
+  if (_grow((void **)&self->buffer, &self->buffer_capacity, total, 1) ||
+      _grow((void **)&self->iov, &self->iov_capacity, 2 * n,
+            sizeof *self->iov)) {
+    return 1;
+  }
+  unsigned char *dst = self->buffer;
+  size_t niov = 0;
+  size_t pending = 0;
+  io_offset end = n ? self->ranges[0].offset : self->pos;
+  if (_seek(self, end)) return 1;
+  for (size_t i = 0; i < n; ++i) {
+    const struct dicm_fragment_range *r = &self->ranges[i];
+    const io_offset gap = r->offset - end;
+    if (gap < 0 || gap > (io_offset)sizeof self->header) {
+      /* not contiguous, start another read */
+      if (_readv(self, self->iov, niov, pending) || _seek(self, r->offset)) {
+        return 1;
+      }
+      niov = pending = 0;
+    } else if (gap) {
+      self->iov[niov].base = self->header;
+      self->iov[niov++].len = (size_t)gap;
+      pending += (size_t)gap;
+    }
+    self->iov[niov].base = dst;
+    self->iov[niov++].len = r->length;
+    pending += r->length;
+    dst += r->length;
+    end = r->offset + (io_offset)r->length;
+  }
+  if (_readv(self, self->iov, niov, pending)) return 1;
+  *size = total;
+  return 0;
+}
+
+int dicm_frames_gather(struct dicm_frames *self, size_t index,
+                       const void **buf, size_t *size) {
+  if (!self->encapsulated) {
+    const size_t frame_size = dicm_frames_get_frame_size(self);
+    if (_grow((void **)&self->buffer, &self->buffer_capacity, frame_size, 1) ||
+        dicm_frames_read(self, index, self->buffer, frame_size)) {
+      return 1;
+    }
+    *buf = self->buffer;
+    *size = frame_size;
+    return 0;
+  }
+  size_t n;
+  if (_collect(self, index, &n) || _gather(self, n, size)) return 1;
+  *buf = self->buffer;
+  return 0;
+}
+
+/* views lent by the io object, one per fragment */
+static int _borrow_fragments(struct dicm_frames *self, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    const struct dicm_fragment_range *r = &self->ranges[i];
+    const void *view;
+    if (_seek(self, r->offset)) return 1;
+    const io_ssize ret = dicm_io_borrow(self->io, &view, r->length);
+    if (ret > 0) self->pos += ret;
+    if (ret != (io_ssize)r->length) return 1;
+    self->iov[i].base = (void *)view;
+    self->iov[i].len = r->length;
+  }
+  return 0;
+}
+
+int dicm_frames_gather_iov(struct dicm_frames *self, size_t index,
+                           const struct dicm_iovec **iov, size_t *count) {
+  if (!self->encapsulated) {
+    if (_grow((void **)&self->iov, &self->iov_capacity, 1, sizeof *self->iov)) {
+      return 1;
+    }
+    const void *buf;
+    size_t size;
+    if (dicm_frames_borrow(self, index, &buf, &size) &&
+        dicm_frames_gather(self, index, &buf, &size)) {
+      return 1;
+    }
+    self->iov[0].base = (void *)buf;
+    self->iov[0].len = size;
+    *iov = self->iov;
+    *count = 1;
+    return 0;
+  }
+  size_t n;
+  if (_collect(self, index, &n) ||
+      _grow((void **)&self->iov, &self->iov_capacity, 2 * n,
+            sizeof *self->iov)) {
+    return 1;
+  }
+  const void *probe;
+  const bool lends = dicm_io_borrow(self->io, &probe, 0) == 0;
+  if (lends) {
+    if (_borrow_fragments(self, n)) return 1;
+  } else {
+    /* one buffer per fragment, within the gathered frame */
+    size_t size;
+    if (_gather(self, n, &size)) return 1;
+    unsigned char *p = self->buffer;
+    for (size_t i = 0; i < n; ++i) {
+      self->iov[i].base = p;
+      self->iov[i].len = self->ranges[i].length;
+      p += self->ranges[i].length;
+    }
+  }
+  *iov = self->iov;
+  *count = n;
+  return 0;
+}
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: LGPLv3 */
+#pragma once
+
+#include "dicm-io.h"
+#include "dicm-public.h"
+#include "dicm-reader.h"
+
+#include <stddef.h> /* size_t */
+
+/* random access to the frames of the Pixel Data of an instance: where each
+ * frame lies is resolved once, then a frame is reached by seeking straight
+ * to it instead of reading the frames before it */
+struct dicm_frames;
+
+/* bytes of one fragment value */
+struct dicm_fragment_range {
+  io_offset offset;
+  size_t length;
+};
+
+/* run reader, which must not have reported any event, up to the Pixel Data of
+ * the root dataset, capturing Number of Frames, the image geometry (Rows,
+ * Columns, Samples per Pixel, Bits Allocated) and the Extended Offset Table
+ * on the way. The io object of reader is then used directly and must support
+ * skipping backward, reader is left at an unspecified position.
+ * Frames of native Pixel Data are computed from the geometry. Frames of
+ * encapsulated Pixel Data are located with the Extended Offset Table, else the
+ * Basic Offset Table, else a scan of the fragment headers (values are skipped)
+ * when there is either one fragment per frame or one frame */
+DICM_EXPORT int dicm_frames_create(struct dicm_frames **pself,
+                                   struct dicm_reader *reader);
+
+DICM_EXPORT int dicm_frames_destroy(struct dicm_frames *self);
+
+DICM_EXPORT size_t dicm_frames_get_count(const struct dicm_frames *self);
+
+/* native: bytes of one frame as returned by dicm_frames_read, 0 when
+ * encapsulated */
+DICM_EXPORT size_t dicm_frames_get_frame_size(const struct dicm_frames *self);
+
+/* native: the bytes holding frame index in the io object of the reader.
+ * With Bits Allocated 1 a frame may start at bit_offset (counted from the
+ * least significant bit) of the first byte, 0 otherwise */
+DICM_EXPORT int dicm_frames_get_range(const struct dicm_frames *self,
+                                      size_t index,
+                                      struct dicm_fragment_range *range,
+                                      unsigned *bit_offset);
+
+/* native: copy frame index to buf, of at least dicm_frames_get_frame_size
+ * bytes, with a single read. Bit-packed frames are shifted to start at bit 0,
+ * padding bits of the last byte are cleared. Words of Explicit VR Big Endian
+ * are swapped to little endian */
+DICM_EXPORT int dicm_frames_read(struct dicm_frames *self, size_t index,
+                                 void *buf, size_t size);
+
+/* native: zero-copy view on frame index (see dicm_io_borrow), e.g. a slice of
+ * a memory mapped file. Fails when the io object cannot lend its storage, for
+ * bit-packed frames not starting on a byte, and for swapped words */
+DICM_EXPORT int dicm_frames_borrow(struct dicm_frames *self, size_t index,
+                                   const void **buf, size_t *size);
+
+/* fragments of frame index (from 0): their number is stored in count, and
+ * the first size of them in ranges. With an offset table only the headers of
+ * the fragments of this frame are read */
+DICM_EXPORT int dicm_frames_get_fragments(struct dicm_frames *self,
+                                          size_t index,
+                                          struct dicm_fragment_range *ranges,
+                                          size_t size, size_t *count);
+
+/* frame index as one contiguous buffer, as codecs expect it: the fragments of
+ * an encapsulated frame are gathered with a single scattered read (see
+ * dicm_io_readv), the item headers between them being read into a sink.
+ * buf is owned by self, reused from one frame to the next and valid until the
+ * next call */
+DICM_EXPORT int dicm_frames_gather(struct dicm_frames *self, size_t index,
+                                   const void **buf, size_t *size);
+
+/* frame index as one read-only buffer per fragment, for codecs taking
+ * scattered input: views lent by the io object when it can (see
+ * dicm_io_borrow), else the fragments gathered as with dicm_frames_gather.
+ * iov is owned by self and valid until the next call */
+DICM_EXPORT int dicm_frames_gather_iov(struct dicm_frames *self, size_t index,
+                                       const struct dicm_iovec **iov,
+                                       size_t *count);
@@ -0,0 +1,175 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* build time generator of dicm-dict-table.h, see dicm-dict.h */
+#include "dicm-dict.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct key {
+  uint32_t tag;
+  const char *vr;
+};
+
+static const struct key keys[] = {
+#define DICT_ENTRY(group, element, vr) \
+  {(uint32_t)(group) << 16u | (uint32_t)(element), #vr},
+#include "dicm-dict.def"
+#undef DICT_ENTRY
+};
+
+enum { NKEYS = sizeof keys / sizeof *keys, MAX_SEEDS = 1000 };
+
+struct table {
+  uint32_t seed;
+  unsigned int bucket_bits;
+  unsigned int slot_bits;
+  uint32_t *displacements;
+  /* key index per slot, NKEYS when empty */
+  size_t *slots;
+};
+
+/* buckets from the largest down, each one takes the first displacement that
+ * sends its keys to free slots */
+static bool place(struct table *t) {
+  const uint32_t nbuckets = 1u << t->bucket_bits;
+  const uint32_t nslots = 1u << t->slot_bits;
+  size_t *sizes = calloc(nbuckets, sizeof *sizes);
+  uint32_t *order = malloc(nbuckets * sizeof *order);
+  for (size_t k = 0; k < NKEYS; ++k) {
+    sizes[dict_bucket(keys[k].tag, t->seed, t->bucket_bits)]++;
+  }
+  for (uint32_t b = 0; b < nbuckets; ++b) order[b] = b;
+  /* few buckets: insertion sort */
+  for (uint32_t i = 1; i < nbuckets; ++i) {
+    const uint32_t b = order[i];
+    uint32_t j = i;
+    for (; j > 0 && sizes[order[j - 1]] < sizes[b]; --j) {
+      order[j] = order[j - 1];
+    }
+    order[j] = b;
+  }
+  for (uint32_t s = 0; s < nslots; ++s) t->slots[s] = NKEYS;
+  bool ok = true;
+  for (uint32_t i = 0; ok && i < nbuckets; ++i) {
+    const uint32_t b = order[i];
+    t->displacements[b] = 0;
+    if (!sizes[b]) continue;
+    ok = false;
+    for (uint32_t d = 0; !ok && d < nslots; ++d) {
+      ok = true;
+      size_t placed = 0;
+      for (size_t k = 0; k < NKEYS; ++k) {
+        if (dict_bucket(keys[k].tag, t->seed, t->bucket_bits) != b) continue;
+        const uint32_t s = dict_slot(keys[k].tag, t->seed, t->slot_bits, d);
+        if (t->slots[s] != NKEYS) {
+          ok = false;
+          break;
+        }
+        t->slots[s] = k;
+        placed++;
+      }
+      if (ok) {
+        t->displacements[b] = d;
+        continue;
+      }
+      /* undo */
+      for (uint32_t s = 0; s < nslots && placed; ++s) {
+        const size_t k = t->slots[s];
+        if (k != NKEYS &&
+            dict_bucket(keys[k].tag, t->seed, t->bucket_bits) == b) {
+          t->slots[s] = NKEYS;
+          placed--;
+        }
+      }
+    }
+  }
+  free(order);
+  free(sizes);
+  return ok;
+}
+
+static void write_table(FILE *out, const struct table *t) {
+  fprintf(out,
+          "/* generated by dicm-gendict from dicm-dict.def, do not edit */\n"
+          "#pragma once\n\n"
+          "enum { DICT_BUCKET_BITS = %u, DICT_SLOT_BITS = %u };\n\n"
+          "static const uint32_t dict_seed = 0x%08xu;\n\n"
+          "static const uint16_t dict_displacements[%u] = {",
+          t->bucket_bits, t->slot_bits, t->seed, 1u << t->bucket_bits);
+  for (uint32_t b = 0; b < 1u << t->bucket_bits; ++b) {
+    fprintf(out, "%s%u", b % 12 ? ", " : (b ? ",\n    " : "\n    "),
+            t->displacements[b]);
+  }
+  fprintf(out, "};\n\nstatic const struct dict_entry dict_entries[%u] = {\n",
+          1u << t->slot_bits);
+  for (uint32_t s = 0; s < 1u << t->slot_bits; ++s) {
+    const size_t k = t->slots[s];
+    if (k == NKEYS) {
+      fprintf(out, "    {0xffffffffu, VR_UN},\n");
+    } else {
+      fprintf(out, "    {0x%08xu, VR_%s},\n", keys[k].tag, keys[k].vr);
+    }
+  }
+  fprintf(out, "};\n");
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: dicm-gendict dicm-dict-table.h\n");
+    return EXIT_FAILURE;
+  }
+  for (size_t i = 0; i < NKEYS; ++i) {
+    for (size_t j = i + 1; j < NKEYS; ++j) {
+      if (keys[i].tag == keys[j].tag) {
+        fprintf(stderr, "duplicate tag %08x\n", keys[i].tag);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  struct table t = {.bucket_bits = 1, .slot_bits = 1};
+  /* about four keys per bucket, slots for 5/4 of the keys */
+  while ((1u << t.bucket_bits) * 4 < NKEYS) t.bucket_bits++;
+  while ((1u << t.slot_bits) * 4 < NKEYS * 5) t.slot_bits++;
+  for (bool found = false; !found; t.slot_bits++) {
+    t.displacements = malloc((1u << t.bucket_bits) * sizeof *t.displacements);
+    t.slots = malloc((1u << t.slot_bits) * sizeof *t.slots);
+    for (uint32_t n = 0; !found && n < MAX_SEEDS; ++n) {
+      t.seed = n * UINT32_C(0x27D4EB2F);
+      found = place(&t);
+    }
+    if (found) break;
+    free(t.displacements);
+    free(t.slots);
+  }
+  FILE *out = fopen(argv[1], "w");
+  if (!out) {
+    perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+  write_table(out, &t);
+  free(t.displacements);
+  free(t.slots);
+  return fclose(out) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,284 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "dicm-index.h"
+
+#include "dicm-item.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char index_magic[8] = {'D', 'I', 'C', 'M', 'I', 'D', 'X', '1'};
+
+enum { INDEX_EMPTY_SLOT = UINT32_MAX };
+
+/* sidecar layout, sections follow the header in this order */
+struct _index_header {
+  char magic[8];
+  uint32_t nentries;
+  uint32_t nsteps;
+  uint32_t slot_bits;
+  uint32_t reserved;
+};
+
+struct _index_entry {
+  uint64_t offset;
+  uint32_t tag;
+  uint32_t vr;
+  uint32_t vl;
+  /* path: nsteps steps from step */
+  uint32_t step;
+  uint32_t nsteps;
+  uint32_t reserved;
+};
+
+struct _index_step {
+  uint32_t tag;
+  uint32_t item;
+};
+
+struct dicm_index {
+  const struct _index_header *header;
+  const struct _index_entry *entries;
+  const struct _index_step *steps;
+  const uint32_t *slots;
+};
+
+static inline uint64_t _step_hash(uint64_t h, uint32_t tag, uint32_t item) {
+  h = (h ^ tag) * UINT64_C(0x9E3779B97F4A7C15);
+  return (h ^ item) * UINT64_C(0x9E3779B97F4A7C15);
+}
+
+static uint64_t _path_hash(const struct _index_step *steps, size_t n) {
+  uint64_t h = 0;
+  for (size_t i = 0; i < n; ++i) h = _step_hash(h, steps[i].tag, steps[i].item);
+  return h;
+}
+
+/* same as _path_hash, over the steps of a user path */
+static uint64_t _tag_path_hash(const struct dicm_tag_path *path) {
+  uint64_t h = 0;
+  for (size_t i = 0; i < path->size; ++i) {
+    h = _step_hash(h, path->steps[i].tag, path->steps[i].item);
+  }
+  return h;
+}
+
+static bool _path_equal(const struct _index_step *steps,
+                        const struct dicm_tag_path *path) {
+  for (size_t i = 0; i < path->size; ++i) {
+    if (steps[i].tag != path->steps[i].tag ||
+        steps[i].item != path->steps[i].item) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static inline size_t _slot_index(uint64_t h, uint32_t slot_bits) {
+  /* high bits are the best mixed */
+  return (size_t)(h >> (64u - slot_bits));
+}
+
+/* one pass builder */
+struct _index_builder {
+  struct _index_entry *entries;
+  size_t nentries;
+  size_t entries_capacity;
+  struct _index_step *steps;
+  size_t nsteps;
+  size_t steps_capacity;
+  /* current path, the item numbers of the open sequences */
+  struct _index_step *path;
+  size_t depth;
+  size_t path_capacity;
+};
+
+static int _grow(void **data, size_t *capacity, size_t needed, size_t size) {
+  if (needed <= *capacity) return 0;
+  size_t capacity_ = *capacity ? *capacity : 64;
+  while (capacity_ < needed) capacity_ *= 2;
+  void *p = realloc(*data, capacity_ * size);
+  if (!p) return 1;
+  *data = p;
+  *capacity = capacity_;
+  return 0;
+}
+
+/* record the first nsteps steps of the current path */
+static int _add_entry(struct _index_builder *b, size_t nsteps,
+                      const struct dicm_attribute *da, io_offset offset) {
+  if (_grow((void **)&b->entries, &b->entries_capacity, b->nentries + 1,
+            sizeof *b->entries) ||
+      _grow((void **)&b->steps, &b->steps_capacity, b->nsteps + nsteps,
+            sizeof *b->steps) ||
+      b->nentries >= UINT32_MAX || b->nsteps + nsteps >= UINT32_MAX) {
+    return 1;
+  }
+  struct _index_entry *entry = &b->entries[b->nentries++];
+  entry->offset = (uint64_t)offset;
+  entry->tag = da->tag;
+  entry->vr = da->vr;
+  entry->vl = da->vl;
+  entry->step = (uint32_t)b->nsteps;
+  entry->nsteps = (uint32_t)nsteps;
+  entry->reserved = 0;
+  memcpy(b->steps + b->nsteps, b->path, nsteps * sizeof *b->steps);
+  b->nsteps += nsteps;
+  return 0;
+}
+
+static int _index_walk(struct _index_builder *b,
+                       struct _dicm_utf8_reader *reader) {
+  for (;;) {
+    const int next = dicm_reader_next_event(&reader->reader);
+    if (next < 0 || reader->inflate) return 1;
+    const struct dicm_attribute *da = &array_back(&reader->item_readers)->da;
+    const io_offset offset = src_tell(&reader->src);
+    switch (next) {
+      case EVENT_END_DATASET:
+        return 0;
+      case EVENT_ATTRIBUTE:
+        if (_grow((void **)&b->path, &b->path_capacity, b->depth + 1,
+                  sizeof *b->path)) {
+          return 1;
+        }
+        b->path[b->depth].tag = da->tag;
+        b->path[b->depth].item = 0;
+        if (_add_entry(b, b->depth + 1, da, offset)) return 1;
+        break;
+      case EVENT_START_SEQUENCE:
+        b->depth++;
+        break;
+      case EVENT_START_ITEM:
+      case EVENT_FRAGMENT:
+        b->path[b->depth - 1].item++;
+        if (_add_entry(b, b->depth, da, offset)) return 1;
+        break;
+      case EVENT_END_SEQUENCE:
+        b->depth--;
+        break;
+      default:;
+    }
+  }
+}
+
+static int _write_all(struct dicm_io *dst, const void *buf, size_t size) {
+  return dicm_io_write(dst, buf, size) != (io_ssize)size;
+}
+
+static int _index_write(const struct _index_builder *b, struct dicm_io *dst) {
+  /* load factor at most 1/2 */
+  uint32_t slot_bits = 1;
+  while (((size_t)1 << slot_bits) < 2 * b->nentries) slot_bits++;
+  const size_t nslots = (size_t)1 << slot_bits;
+  uint32_t *slots = malloc(nslots * sizeof *slots);
+  if (!slots) return 1;
+  for (size_t i = 0; i < nslots; ++i) slots[i] = INDEX_EMPTY_SLOT;
+  for (size_t e = 0; e < b->nentries; ++e) {
+    const struct _index_entry *entry = &b->entries[e];
+    const uint64_t h = _path_hash(b->steps + entry->step, entry->nsteps);
+    size_t i = _slot_index(h, slot_bits);
+    while (slots[i] != INDEX_EMPTY_SLOT) i = (i + 1) & (nslots - 1);
+    slots[i] = (uint32_t)e;
+  }
+  struct _index_header header = {.nentries = (uint32_t)b->nentries,
+                                 .nsteps = (uint32_t)b->nsteps,
+                                 .slot_bits = slot_bits};
+  memcpy(header.magic, index_magic, sizeof index_magic);
+  const int res =
+      _write_all(dst, &header, sizeof header) ||
+      _write_all(dst, b->entries, b->nentries * sizeof *b->entries) ||
+      _write_all(dst, b->steps, b->nsteps * sizeof *b->steps) ||
+      _write_all(dst, slots, nslots * sizeof *slots);
+  free(slots);
+  return res;
+}
+
+int dicm_index_build(struct dicm_reader *reader_, struct dicm_io *dst) {
+  struct _dicm_utf8_reader *reader = (struct _dicm_utf8_reader *)reader_;
+  if (reader->current_state != STATE_INIT) return 1;
+  struct _index_builder b = {0};
+  const int res = _index_walk(&b, reader) || _index_write(&b, dst);
+  free(b.entries);
+  free(b.steps);
+  free(b.path);
+  return res;
+}
+
+int dicm_index_create(struct dicm_index **pself, const void *data,
+                      size_t size) {
+  *pself = NULL;
+  const struct _index_header *header = data;
+  if (size < sizeof *header ||
+      memcmp(header->magic, index_magic, sizeof index_magic) != 0 ||
+      header->slot_bits == 0 || header->slot_bits > 31) {
+    return 1;
+  }
+  const size_t entries = sizeof *header;
+  const size_t steps =
+      entries + (size_t)header->nentries * sizeof(struct _index_entry);
+  const size_t slots =
+      steps + (size_t)header->nsteps * sizeof(struct _index_step);
+  if (size != slots + ((size_t)1 << header->slot_bits) * sizeof(uint32_t)) {
+    return 1;
+  }
+  struct dicm_index *self = malloc(sizeof *self);
+  if (!self) return 1;
+  const unsigned char *p = data;
+  self->header = header;
+  self->entries = (const struct _index_entry *)(const void *)(p + entries);
+  self->steps = (const struct _index_step *)(const void *)(p + steps);
+  self->slots = (const uint32_t *)(const void *)(p + slots);
+  *pself = self;
+  return 0;
+}
+
+int dicm_index_destroy(struct dicm_index *self) {
+  free(self);
+  return 0;
+}
+
+int dicm_index_find(const struct dicm_index *self,
+                    const struct dicm_tag_path *path,
+                    struct dicm_index_entry *entry) {
+  const uint32_t slot_bits = self->header->slot_bits;
+  const size_t nslots = (size_t)1 << slot_bits;
+  size_t i = _slot_index(_tag_path_hash(path), slot_bits);
+  /* a forged table may have no empty slot */
+  for (size_t probe = 0; probe < nslots; ++probe, i = (i + 1) & (nslots - 1)) {
+    const uint32_t e = self->slots[i];
+    if (e == INDEX_EMPTY_SLOT || e >= self->header->nentries) return 1;
+    const struct _index_entry *found = &self->entries[e];
+    /* the sidecar is not trusted */
+    if ((uint64_t)found->step + found->nsteps > self->header->nsteps) return 1;
+    if (found->nsteps == path->size &&
+        _path_equal(self->steps + found->step, path)) {
+      entry->tag = found->tag;
+      entry->vr = found->vr;
+      entry->vl = found->vl;
+      entry->offset = (io_offset)found->offset;
+      return 0;
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: LGPLv3 */
+#pragma once
+
+#include "dicm-io.h"
+#include "dicm-public.h"
+#include "dicm-reader.h"
+
+#include <stddef.h> /* size_t */
+
+/* offsets of every attribute, item and fragment of a dataset, recorded in one
+ * pass and stored in a sidecar, so that values are read with one pread(2)
+ * when the instance is opened again, without parsing it.
+ * The sidecar is position independent and meant to be mapped as is: a header,
+ * the entries, their tag paths, and an open addressing hash table of the
+ * paths, all little endian */
+struct dicm_index;
+
+/* what the index knows about a path */
+struct dicm_index_entry {
+  /* TAG_STARTITEM for items and fragments */
+  dicm_tag_t tag;
+  dicm_vr_t vr;
+  dicm_vl_t vl;
+  /* where the value, or the content of the item, starts in the io object of
+   * the reader */
+  io_offset offset;
+};
+
+/* run reader, which must not have reported any event, to the end of dataset
+ * and write the sidecar to dst. Deflated datasets cannot be indexed: offsets
+ * would be in the inflated stream */
+DICM_EXPORT int dicm_index_build(struct dicm_reader *reader,
+                                 struct dicm_io *dst);
+
+/* index over a sidecar, e.g. memory mapped, which must outlive it */
+DICM_EXPORT int dicm_index_create(struct dicm_index **pself, const void *data,
+                                  size_t size);
+
+DICM_EXPORT int dicm_index_destroy(struct dicm_index *self);
+
+/* look up an attribute, all steps but the last giving an item number (1 for
+ * the first item, DICM_ANY_ITEM is not allowed). A last step with an item
+ * number looks up that item, or that fragment of encapsulated Pixel Data, the
+ * Basic Offset Table being fragment 1. Returns 1 when not found */
+DICM_EXPORT int dicm_index_find(const struct dicm_index *self,
+                                const struct dicm_tag_path *path,
+                                struct dicm_index_entry *entry);
@@ -11,6 +11,14 @@
 typedef int64_t io_ssize;  /* ssize_t */
 typedef int64_t io_offset; /* off_t */
 
+struct dicm_io;
+
+/* one buffer of a scattered read, laid out as struct iovec (readv(2)) */
+struct dicm_iovec {
+  void *base;
+  size_t len;
+};
+
 // mimic read(2), write(2) and lseek(2) API, but i cannot use ssize_t (POSIX)
 // it should be acceptable to hard-code API to 64bits since DICOM is pretty-much
 // 32bits by design
@@ -22,6 +30,25 @@ struct io_prv_vtable {
   DICM_CHECK_RETURN io_offset (*fp_skip)(void *const, io_offset) DICM_NONNULL;
   DICM_CHECK_RETURN io_ssize (*fp_write)(void *const, const void *,
                                          size_t) DICM_NONNULL;
+  /* optional: lend a read-only view on the next bytes instead of copying
+   * them, and advance the cursor. Returns the number of bytes lent, or -1
+   * with the cursor left unchanged when fewer than requested remain. The view
+   * remains valid until the io object is destroyed. */
+  DICM_CHECK_RETURN io_ssize (*fp_borrow)(void *const, const void **,
+                                          size_t) DICM_NONNULL;
+  /* optional: move the next bytes straight to dst (copy_file_range,
+   * sendfile...), advancing both cursors. Returns the number of bytes moved,
+   * or -1 if nothing could be moved this way. */
+  DICM_CHECK_RETURN io_ssize (*fp_transfer)(void *const, struct dicm_io *,
+                                            size_t) DICM_NONNULL;
+  /* optional: access pattern hint for the next bytes (see dicm_io_advice),
+   * returns 0 or an errno value */
+  DICM_CHECK_RETURN int (*fp_advise)(void *const, int, size_t) DICM_NONNULL;
+  /* optional: fill the buffers one after the other with the next bytes, in as
+   * few system calls as possible (preadv). Returns the number of bytes read,
+   * less than requested only at end of file */
+  DICM_CHECK_RETURN io_ssize (*fp_readv)(void *const, const struct dicm_iovec *,
+                                         size_t) DICM_NONNULL;
 };
 
 /* common io vtable */
@@ -38,6 +65,64 @@ struct dicm_io {
 /* common io interface */
 #define dicm_io_read(t, b, s) ((t)->vtable->io.fp_read((t), (b), (s)))
 #define dicm_io_write(t, b, s) ((t)->vtable->io.fp_write((t), (b), (s)))
+#define dicm_io_skip(t, o) ((t)->vtable->io.fp_skip((t), (o)))
+
+/* return -1 when the io object cannot lend its internal storage */
+static inline io_ssize dicm_io_borrow(struct dicm_io *self, const void **buf,
+                                      size_t size) {
+  if (self->vtable->io.fp_borrow) {
+    return self->vtable->io.fp_borrow(self, buf, size);
+  }
+  return -1;
+}
+
+/* return -1 when src and dst cannot be connected directly */
+static inline io_ssize dicm_io_transfer(struct dicm_io *src,
+                                        struct dicm_io *dst, size_t size) {
+  if (src->vtable->io.fp_transfer) {
+    return src->vtable->io.fp_transfer(src, dst, size);
+  }
+  return -1;
+}
+
+/* access pattern hints, mapped to posix_fadvise(2) / posix_madvise(3) */
+enum dicm_io_advice {
+  DICM_IO_ADVICE_NORMAL = 0,
+  /* whole file streamed once: aggressive read-ahead */
+  DICM_IO_ADVICE_SEQUENTIAL = 1,
+  /* mostly skipping: no read-ahead */
+  DICM_IO_ADVICE_RANDOM = 2,
+  /* only the next length bytes matter (metadata sweep): fetch them at once,
+   * no read-ahead past them, and drop the file from the page cache when the io
+   * object is destroyed, so that a sweep does not evict the hot working set */
+  DICM_IO_ADVICE_HEADER_ONLY = 3
+};
+
+/* hints are advisory: io objects without a page cache behind them (memory,
+ * pipes) accept and ignore them */
+static inline int dicm_io_advise(struct dicm_io *self, int advice,
+                                 size_t length) {
+  if (self->vtable->io.fp_advise) {
+    return self->vtable->io.fp_advise(self, advice, length);
+  }
+  return 0;
+}
+
+/* falls back to one read per buffer */
+static inline io_ssize dicm_io_readv(struct dicm_io *self,
+                                     const struct dicm_iovec *iov, size_t n) {
+  if (self->vtable->io.fp_readv) {
+    return self->vtable->io.fp_readv(self, iov, n);
+  }
+  io_ssize read = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const io_ssize ret = dicm_io_read(self, iov[i].base, iov[i].len);
+    if (ret < 0) return -1;
+    read += ret;
+    if ((size_t)ret != iov[i].len) break;
+  }
+  return read;
+}
 
 enum IO_TYPES { DICM_IO_READ = 1, DICM_IO_WRITE = 2 };
 
@@ -47,3 +132,89 @@ DICM_CHECK_RETURN int dicm_io_file_create(struct dicm_io **pself,
 
 DICM_CHECK_RETURN int dicm_io_stream_create(struct dicm_io **pself,
                                             int io_mode) DICM_NONNULL;
+
+/* positional io (pread/pwrite): the cursor lives in the io object, not in the
+ * file descriptor, so that several cursors can share one descriptor */
+DICM_CHECK_RETURN int dicm_io_fd_create(struct dicm_io **pself,
+                                        const char *filename,
+                                        int io_mode) DICM_NONNULL;
+
+/* new cursor at offset, sharing the descriptor of an io object created with
+ * dicm_io_fd_create. Cursors can be used from different threads, the
+ * descriptor is closed along with the last one */
+DICM_CHECK_RETURN int dicm_io_fd_clone(struct dicm_io **pclone,
+                                       struct dicm_io *self,
+                                       io_offset offset) DICM_NONNULL;
+
+/* read-only memory mapped file, see dicm_io_borrow */
+DICM_CHECK_RETURN int dicm_io_mmap_create(struct dicm_io **pself,
+                                          const char *filename) DICM_NONNULL;
+
+/* read-only io bypassing the page cache (O_DIRECT), for large instances that
+ * are streamed once. Reads go through an aligned buffer of buffer_size bytes
+ * (rounded up to the device alignment, 0 means 1MB), except whole aligned
+ * blocks read at an aligned offset into an aligned buffer, which go there
+ * directly. Falls back to buffered reads where the file system refuses
+ * O_DIRECT */
+DICM_CHECK_RETURN int dicm_io_direct_create(struct dicm_io **pself,
+                                            const char *filename,
+                                            size_t buffer_size) DICM_NONNULL;
+
+/* read-only io over caller-owned memory, which must outlive the io object */
+DICM_CHECK_RETURN int dicm_io_mem_create(struct dicm_io **pself,
+                                         const void *data,
+                                         size_t size) DICM_NONNULL1(1);
+
+/* same as dicm_io_mem_create, but data was allocated with malloc(3) and is
+ * released when the io object is destroyed */
+DICM_CHECK_RETURN int dicm_io_mem_adopt(struct dicm_io **pself, void *data,
+                                        size_t size) DICM_NONNULL1(1);
+
+/* growable memory sink, pre-allocated to capacity bytes (may be 0) */
+DICM_CHECK_RETURN int dicm_io_memsink_create(struct dicm_io **pself,
+                                             size_t capacity) DICM_NONNULL;
+
+/* hand over the sink storage without copy, release it with free(3). The sink
+ * is left empty */
+DICM_CHECK_RETURN int dicm_io_memsink_release(struct dicm_io *self,
+                                              void **pdata,
+                                              size_t *psize) DICM_NONNULL;
+
+/* compressed data of dicm_io_deflate_create */
+enum dicm_deflate_format {
+  /* raw deflate, Deflated Explicit VR Little Endian transfer syntax */
+  DICM_DEFLATE_RAW = 0,
+  /* gzip (.dcm.gz), zlib streams are accepted too on read */
+  DICM_DEFLATE_GZIP = 1
+};
+
+/* streaming adapter stacked on io, which must outlive it: inflates what is
+ * read from io (DICM_IO_READ), or deflates what is written to it
+ * (DICM_IO_WRITE) at zlib level (0-9, -1 for the default, ignored on read).
+ * Buffers are bounded, skipping inflates and drops. Destroying a writing
+ * adapter finishes the compressed stream, io is left open. Returns ENOSYS
+ * when built without zlib */
+DICM_EXPORT DICM_CHECK_RETURN int dicm_io_deflate_create(
+    struct dicm_io **pself, struct dicm_io *io, int io_mode, int format,
+    int level) DICM_NONNULL;
+
+/* batch of whole files read ahead using io_uring, or pread(2) when io_uring is
+ * not available. Up to depth files are opened and read concurrently */
+struct dicm_io_batch;
+
+DICM_CHECK_RETURN int dicm_io_batch_create(struct dicm_io_batch **pself,
+                                           unsigned int depth) DICM_NONNULL;
+
+/* queue filename, which must remain valid until returned by next */
+DICM_CHECK_RETURN int dicm_io_batch_add(struct dicm_io_batch *self,
+                                        const char *filename,
+                                        void *user_data) DICM_NONNULL1(1);
+
+/* wait for the next completed file, and return an io object over its content
+ * (see dicm_io_mem_adopt). Files are returned in completion order. Returns -1
+ * once the batch is drained, an errno value if this file failed */
+DICM_CHECK_RETURN int dicm_io_batch_next(struct dicm_io_batch *self,
+                                         struct dicm_io **pio,
+                                         void **puser_data) DICM_NONNULL;
+
+int dicm_io_batch_destroy(struct dicm_io_batch *self) DICM_NONNULL;
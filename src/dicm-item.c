@@ -19,6 +19,8 @@
  *
  */
 #include "dicm-item.h"
+#include "dicm-dict.h"
+#include "dicm-dict-table.h"
 #include "dicm-private.h"
 #include "dicm-reader.h"
 
@@ -29,10 +31,146 @@
 
 bool dicm_vr_is_16(const dicm_vr_t vr) { return _is_vr16(vr); }
 
+bool src_create(struct dicm_src *src, struct dicm_io *io,
+                const size_t capacity) {
+  // need room for at least one full explicit data element header:
+  assert(capacity >= sizeof(union _ude));
+  unsigned char *data = malloc(capacity);
+  if (!data) return false;
+  src->io = io;
+  src->data = data;
+  src->capacity = capacity;
+  src->cur = src->end = data;
+  src->offset = 0;
+  return true;
+}
+
+size_t src_fill(struct dicm_src *src, const size_t size) {
+  assert(size <= src->capacity);
+  struct dicm_io *io = src->io;
+  const size_t available = src_available(src);
+  bool lend = io->vtable->io.fp_borrow != NULL;
+  if (lend && available == 0) {
+    // no copy at all, use the io storage as block:
+    const void *view;
+    const io_ssize ssize = dicm_io_borrow(io, &view, src->capacity);
+    if (ssize > 0) {
+      src->cur = view;
+      src->end = src->cur + ssize;
+      src->offset += ssize;
+      return (size_t)ssize;
+    }
+    // less than a block left, copy it whole:
+    lend = false;
+  }
+  // move the leftover in front of the block, then complete it:
+  memmove(src->data, src->cur, available);
+  src->cur = src->data;
+  src->end = src->data + available;
+  // when io can lend, only copy the bytes straddling two views:
+  const size_t to_read = lend ? size - available : src->capacity - available;
+  const io_ssize ssize = dicm_io_read(io, src->data + available, to_read);
+  if (ssize > 0) {
+    src->end += ssize;
+    src->offset += ssize;
+  }
+  return src_available(src);
+}
+
+io_ssize src_read(struct dicm_src *src, void *buf, const size_t size) {
+  const size_t available = src_available(src);
+  if (likely(size <= available)) {
+    memcpy(buf, src->cur, size);
+    src->cur += size;
+    return (io_ssize)size;
+  }
+  memcpy(buf, src->cur, available);
+  src->cur = src->end;
+  unsigned char *rest = (unsigned char *)buf + available;
+  const size_t rest_size = size - available;
+  if (rest_size >= src->capacity) {
+    // large value, do not bother copying into the block:
+    const io_ssize ssize = dicm_io_read(src->io, rest, rest_size);
+    if (ssize < 0) return ssize;
+    src->offset += ssize;
+    return (io_ssize)available + ssize;
+  }
+  const size_t filled = src_fill(src, rest_size);
+  const size_t len = filled < rest_size ? filled : rest_size;
+  memcpy(rest, src->cur, len);
+  src->cur += len;
+  return (io_ssize)(available + len);
+}
+
+io_offset src_skip(struct dicm_src *src, const io_offset off) {
+  assert(off >= 0);
+  const size_t available = src_available(src);
+  if ((size_t)off <= available) {
+    src->cur += off;
+    return src_tell(src);
+  }
+  src->cur = src->end;
+  const io_offset rest = off - (io_offset)available;
+  if (dicm_io_skip(src->io, rest) < 0) return -1;
+  src->offset += rest;
+  return src_tell(src);
+}
+
+io_ssize src_transfer(struct dicm_src *src, struct dicm_io *dst,
+                      const size_t size) {
+  // whatever is already in the block goes first:
+  const size_t available = src_available(src);
+  const size_t head = size < available ? size : available;
+  if (head && dicm_io_write(dst, src->cur, head) != (io_ssize)head) return -1;
+  src->cur += head;
+  size_t rest = size - head;
+  if (rest == 0) return (io_ssize)size;
+  struct dicm_io *io = src->io;
+  const io_ssize moved = dicm_io_transfer(io, dst, rest);
+  if (moved > 0) {
+    src->offset += moved;
+    rest -= (size_t)moved;
+  }
+  // fallback, bounce through the (now empty) block:
+  src->cur = src->end = src->data;
+  while (rest != 0) {
+    const size_t len = rest < src->capacity ? rest : src->capacity;
+    const io_ssize ssize = dicm_io_read(io, src->data, len);
+    if (ssize != (io_ssize)len) return -1;
+    src->offset += ssize;
+    if (dicm_io_write(dst, src->data, len) != ssize) return -1;
+    rest -= len;
+  }
+  return (io_ssize)size;
+}
+
+bool src_borrow(struct dicm_src *src, const void **buf, const size_t size) {
+  const size_t available = src_available(src);
+  if (size <= available ||
+      (size <= src->capacity && src_fill(src, size) >= size)) {
+    *buf = src->cur;
+    src->cur += size;
+    return true;
+  }
+  struct dicm_io *io = src->io;
+  if (io->vtable->io.fp_borrow == NULL) return false;
+  // storage lending io are memory backed, so rewind over the leftover and lend
+  // the whole value at once:
+  if (available && dicm_io_skip(io, -(io_offset)available) < 0) return false;
+  src->offset -= (io_offset)available;
+  src->cur = src->end = src->data;
+  const io_ssize ssize = dicm_io_borrow(io, buf, size);
+  if (ssize < 0) return false;
+  src->offset += ssize;
+  return ssize == (io_ssize)size;
+}
+
 static inline bool _tag_is_valid(const dicm_tag_t tag) {
   // The following cases have been handled by design:
   assert(tag != TAG_STARTITEM && tag != TAG_ENDITEM && tag != TAG_ENDSQITEM);
-  return dicm_tag_get_group(tag) >= 0x0008;
+  // File Meta Information, or dataset:
+  const uint_fast16_t group = dicm_tag_get_group(tag);
+  return group == 0x0002 || group >= 0x0008;
 }
 
 static inline bool _tag_is_creator(const dicm_tag_t tag) {
@@ -73,22 +211,43 @@ static inline bool _attribute_is_valid(const struct dicm_attribute *da) {
   return true;
 }
 
+/* VR of an Implicit VR attribute, from the data dictionary */
+static inline dicm_vr_t _implicit_get_vr(const dicm_tag_t tag,
+                                         const dicm_vl_t vl) {
+  if (dicm_vl_is_undefined(vl)) {
+    // encapsulated pixel data, or a sequence even when unknown (CP-246):
+    return tag == TAG_PIXELDATA ? VR_OB : VR_SQ;
+  }
+  const uint32_t bucket = dict_bucket(tag, dict_seed, DICT_BUCKET_BITS);
+  const struct dict_entry *entry = &dict_entries[dict_slot(
+      tag, dict_seed, DICT_SLOT_BITS, dict_displacements[bucket])];
+  if (entry->tag == tag) return entry->vr;
+  if (dicm_tag_is_group_length(tag)) return VR_UL;
+  if (_tag_is_creator(tag)) return VR_LO;
+  return VR_UN;
+}
+
 static enum dicm_token _item_reader_next_impl(struct dicm_item_reader *self,
-                                              struct dicm_io *src) {
+                                              struct dicm_src *src) {
   union _ude ude;
   _Static_assert(16 == sizeof(ude), "16 bytes");
   _Static_assert(12 == sizeof(struct _ede32), "12 bytes");
   _Static_assert(8 == sizeof(struct _ede16), "8 bytes");
   _Static_assert(8 == sizeof(struct _ide), "8 bytes");
-  io_ssize ssize = dicm_io_read(src, ude.bytes, 8);
-  if (ssize != 8) {
-    return ssize == 0 ? TOKEN_EOF : TOKEN_INVALID_DATA;
+  const void *header = src_peek(src, 8);
+  if (!header) {
+    return src_available(src) == 0 ? TOKEN_EOF : TOKEN_INVALID_DATA;
   }
+  memcpy(ude.bytes, header, 8);
+  src_consume(src, 8);
 
+  const bool big_endian = self->encoding == DICM_VR_EXPLICIT_BE;
   {
-    const dicm_tag_t tag = _ide_get_tag(&ude);
+    const dicm_tag_t tag =
+        big_endian ? _ide_get_tag_be(&ude) : _ide_get_tag(&ude);
     self->da.tag = tag;
-    const dicm_vl_t ide_vl = _ide_get_vl(&ude);
+    const dicm_vl_t ide_vl =
+        big_endian ? _ide_get_vl_be(&ude) : _ide_get_vl(&ude);
     switch (tag) {
       case TAG_STARTITEM:
         self->da.vr = VR_NONE;
@@ -108,21 +267,30 @@ static enum dicm_token _item_reader_next_impl(struct dicm_item_reader *self,
     }
   }
 
-  const dicm_vr_t vr = _ede16_get_vr(&ude);
-  self->da.vr = vr;
-  if (_is_vr16(vr)) {
-    const dicm_vl_t vl = _ede16_get_vl(&ude);
-    self->da.vl = vl;
+  if (self->encoding == DICM_VR_IMPLICIT) {
+    self->da.vl = _ide_get_vl(&ude);
+    self->da.vr = _implicit_get_vr(self->da.tag, self->da.vl);
   } else {
-    // FIXME: this statement checks if VR is actually valid (0 padded), which is
-    // redundant with `_attribute_is_valid`:
-    if (ude.ede16.vl16 != 0) return TOKEN_INVALID_DATA;
+    const dicm_vr_t vr = _ede16_get_vr(&ude);
+    self->da.vr = vr;
+    if (_is_vr16(vr)) {
+      const dicm_vl_t vl =
+          big_endian ? _ede16_get_vl_be(&ude) : _ede16_get_vl(&ude);
+      self->da.vl = vl;
+    } else {
+      // FIXME: this statement checks if VR is actually valid (0 padded), which
+      // is redundant with `_attribute_is_valid`:
+      if (ude.ede16.vl16 != 0) return TOKEN_INVALID_DATA;
 
-    ssize = dicm_io_read(src, &ude.ede32.vl, 4);
-    if (ssize != 4) return TOKEN_INVALID_DATA;
+      header = src_peek(src, 4);
+      if (!header) return TOKEN_INVALID_DATA;
+      memcpy(&ude.ede32.vl, header, 4);
+      src_consume(src, 4);
 
-    const dicm_vl_t vl = _ede32_get_vl(&ude);
-    self->da.vl = vl;
+      const dicm_vl_t vl =
+          big_endian ? _ede32_get_vl_be(&ude) : _ede32_get_vl(&ude);
+      self->da.vl = vl;
+    }
   }
 
   if (!_attribute_is_valid(&self->da)) {
@@ -133,6 +301,184 @@ static enum dicm_token _item_reader_next_impl(struct dicm_item_reader *self,
   return TOKEN_ATTRIBUTE;
 }
 
+bool src_skip_subtree(struct dicm_src *src,
+                      const enum dicm_vr_encoding encoding,
+                      const bool through_end) {
+  const bool implicit = encoding == DICM_VR_IMPLICIT;
+  const bool big_endian = encoding == DICM_VR_EXPLICIT_BE;
+  /* open sequences and items, the current one included */
+  unsigned int depth = 1;
+  union _ude ude;
+  for (;;) {
+    const void *header = src_peek(src, 8);
+    if (!header) return false;
+    memcpy(ude.bytes, header, 8);
+    dicm_vl_t vl;
+    switch (big_endian ? _ide_get_tag_be(&ude) : _ide_get_tag(&ude)) {
+      case TAG_STARTITEM:
+        vl = big_endian ? _ide_get_vl_be(&ude) : _ide_get_vl(&ude);
+        src_consume(src, 8);
+        break;
+      case TAG_ENDITEM:
+      case TAG_ENDSQITEM:
+        if (depth == 1 && !through_end) return true;
+        src_consume(src, 8);
+        if (--depth == 0) return true;
+        continue;
+      default:
+        if (implicit) {
+          vl = _ide_get_vl(&ude);
+          src_consume(src, 8);
+        } else if (_is_vr16(_ede16_get_vr(&ude))) {
+          vl = big_endian ? _ede16_get_vl_be(&ude) : _ede16_get_vl(&ude);
+          src_consume(src, 8);
+        } else {
+          header = src_peek(src, 12);
+          if (!header) return false;
+          memcpy(ude.bytes, header, 12);
+          vl = big_endian ? _ede32_get_vl_be(&ude) : _ede32_get_vl(&ude);
+          src_consume(src, 12);
+        }
+    }
+    /* undefined length: sequence, item or encapsulated pixel data */
+    if (dicm_vl_is_undefined(vl)) {
+      depth++;
+    } else if (src_skip(src, vl) < 0) {
+      return false;
+    }
+  }
+}
+
+/* first attribute of a dataset without File Meta Information: a VR tells
+ * explicit from implicit, then the byte order giving the smaller group wins,
+ * e.g. 0008 over 0800 */
+static enum dicm_vr_encoding _guess_encoding(const union _ude *ude) {
+  if (!_vr_is_valid(_ede16_get_vr(ude))) return DICM_VR_IMPLICIT;
+  return dicm_tag_get_group(_ide_get_tag_be(ude)) <
+                 dicm_tag_get_group(_ide_get_tag(ude))
+             ? DICM_VR_EXPLICIT_BE
+             : DICM_VR_EXPLICIT;
+}
+
+/* walk the File Meta Information, always Explicit VR Little Endian, in the
+ * read-ahead block. Only the part up to the Transfer Syntax UID has to fit
+ * when File Meta Information Group Length tells where the group ends */
+static bool _src_walk_meta(struct dicm_src *src, struct dicm_meta *meta) {
+  size_t off = 0;
+  /* from the group length, 0 when unknown */
+  size_t group_end = 0;
+  bool found = false;
+  union _ude ude;
+  for (;;) {
+    if (found && group_end) {
+      off = group_end;
+      break;
+    }
+    /* the rest of the group does not fit in the read-ahead block */
+    if (off + 12 > src->capacity) return false;
+    const unsigned char *p = src_peek(src, off + 8);
+    if (!p) break; /* end of file */
+    memcpy(ude.bytes, p + off, 8);
+    const dicm_tag_t tag = _ide_get_tag(&ude);
+    if (dicm_tag_get_group(tag) != 0x0002) break;
+    size_t vl;
+    if (_is_vr16(_ede16_get_vr(&ude))) {
+      vl = _ede16_get_vl(&ude);
+      off += 8;
+    } else {
+      p = src_peek(src, off + 12);
+      if (!p) return false;
+      memcpy(ude.bytes, p + off, 12);
+      vl = _ede32_get_vl(&ude);
+      off += 12;
+    }
+    if (dicm_vl_is_undefined((dicm_vl_t)vl)) return false;
+    /* first, with a 4 bytes value after its 8 bytes header */
+    if (tag == MAKE_TAG(0x0002, 0x0000) && off == 8 && vl == 4) {
+      p = src_peek(src, 12);
+      if (!p) return false;
+      group_end = 12 + ((size_t)p[8] | (size_t)p[9] << 8u |
+                        (size_t)p[10] << 16u | (size_t)p[11] << 24u);
+    }
+    if (tag == TAG_TRANSFERSYNTAX) {
+      if (vl >= sizeof meta->transfer_syntax || off + vl > src->capacity) {
+        return false;
+      }
+      p = src_peek(src, off + vl);
+      if (!p) return false;
+      char *ts = meta->transfer_syntax;
+      memcpy(ts, p + off, vl);
+      /* UI values are padded with a null byte */
+      size_t len = vl;
+      while (len && (ts[len - 1] == '\0' || ts[len - 1] == ' ')) len--;
+      ts[len] = '\0';
+      found = true;
+    }
+    off += vl;
+    /* group length shorter than what it counts */
+    if (group_end && off > group_end) return false;
+  }
+  meta->end = src_tell(src) + (io_offset)off;
+  /* deflate is applied on top of Explicit VR Little Endian */
+  const char *ts = meta->transfer_syntax;
+  meta->deflated = strcmp(ts, "1.2.840.10008.1.2.1.99") == 0;
+  if (strcmp(ts, "1.2.840.10008.1.2") == 0) {
+    meta->encoding = DICM_VR_IMPLICIT;
+  } else if (strcmp(ts, "1.2.840.10008.1.2.2") == 0) {
+    meta->encoding = DICM_VR_EXPLICIT_BE;
+  } else {
+    /* encapsulated pixel data and unknown syntaxes too */
+    meta->encoding = DICM_VR_EXPLICIT;
+  }
+  return true;
+}
+
+bool src_sniff(struct dicm_src *src, struct dicm_meta *meta) {
+  meta->transfer_syntax[0] = '\0';
+  meta->end = -1;
+  meta->encoding = DICM_VR_EXPLICIT;
+  meta->deflated = false;
+  /* 128 bytes preamble and DICM prefix, absent from raw datasets */
+  if (src->capacity < SRC_SNIFF_SIZE) return false;
+  const unsigned char *p = src_peek(src, SRC_SNIFF_SIZE);
+  if (p && memcmp(p + 128, "DICM", 4) == 0) src_consume(src, SRC_SNIFF_SIZE);
+  p = src_peek(src, 8);
+  if (!p) return true; /* empty dataset */
+  union _ude ude;
+  memcpy(ude.bytes, p, 8);
+  if (dicm_tag_get_group(_ide_get_tag(&ude)) == 0x0002) {
+    return _src_walk_meta(src, meta);
+  }
+  meta->encoding = _guess_encoding(&ude);
+  return true;
+}
+
+/* next token of a sequence reader. At the end of a defined length sequence
+ * or item there is no delimiter to read: it is synthesized once src reaches
+ * end (0 when undefined) */
+static enum dicm_token _item_reader_next_bounded(struct dicm_item_reader *self,
+                                                 struct dicm_src *src,
+                                                 const io_offset end,
+                                                 const dicm_tag_t delimiter) {
+  if (end) {
+    const io_offset pos = src_tell(src);
+    if (pos > end) return TOKEN_INVALID_DATA;
+    if (pos == end) {
+      self->da.tag = delimiter;
+      self->da.vr = VR_NONE;
+      self->da.vl = 0;
+      return delimiter == TAG_ENDITEM ? TOKEN_ENDITEM : TOKEN_ENDSQITEM;
+    }
+  }
+  const enum dicm_token next = _item_reader_next_impl(self, src);
+  if (next == TOKEN_STARTITEM) {
+    self->item_end = dicm_vl_is_undefined(self->da.vl)
+                         ? 0
+                         : src_tell(src) + (io_offset)self->da.vl;
+  }
+  return next;
+}
+
 static inline enum dicm_token _item_reader_next_impl2(
     struct dicm_item_reader *self) {
   const dicm_vr_t vr = self->da.vr;
@@ -148,7 +494,7 @@ static inline enum dicm_token _item_reader_next_impl2(
 }
 
 int dicm_ds_reader_next_event(struct dicm_item_reader *self,
-                              struct dicm_io *src) {
+                              struct dicm_src *src) {
   const enum dicm_state current_state = self->current_item_state;
   enum dicm_token next;
   switch (current_state) {
@@ -173,7 +519,8 @@ int dicm_ds_reader_next_event(struct dicm_item_reader *self,
     case STATE_ENDSEQUENCE:  // re-enter case
     case STATE_VALUE:
       // TODO: check user has consumed everything
-      assert(dicm_vl_is_undefined(self->da.vl) ||
+      assert(current_state == STATE_ENDSEQUENCE ||
+             dicm_vl_is_undefined(self->da.vl) ||
              self->da.vl == self->value_length_pos);
       next = _item_reader_next_impl(self, src);
       if (next == TOKEN_EOF) {
@@ -195,12 +542,13 @@ int dicm_ds_reader_next_event(struct dicm_item_reader *self,
 }
 
 int dicm_item_reader_next_event(struct dicm_item_reader *self,
-                                struct dicm_io *src) {
+                                struct dicm_src *src) {
   const enum dicm_state current_state = self->current_item_state;
   enum dicm_token next;
   switch (current_state) {
     case STATE_STARTSEQUENCE:  // default enter
-      next = _item_reader_next_impl(self, src);
+      next = _item_reader_next_bounded(self, src, self->sequence_end,
+                                       TAG_ENDSQITEM);
       assert(next == TOKEN_STARTITEM || next == TOKEN_ENDSQITEM);
       self->current_item_state =
           next == TOKEN_STARTITEM
@@ -208,7 +556,7 @@ int dicm_item_reader_next_event(struct dicm_item_reader *self,
               : (next == TOKEN_ENDSQITEM ? STATE_ENDSEQUENCE : STATE_INVALID);
       break;
     case STATE_STARTITEM:
-      next = _item_reader_next_impl(self, src);
+      next = _item_reader_next_bounded(self, src, self->item_end, TAG_ENDITEM);
       assert(next == TOKEN_ATTRIBUTE || next == TOKEN_ENDITEM);
       self->current_item_state =
           next == TOKEN_ATTRIBUTE
@@ -230,7 +578,7 @@ int dicm_item_reader_next_event(struct dicm_item_reader *self,
     case STATE_VALUE:
       // TODO: check user has consumed everything
       assert(self->da.vl == self->value_length_pos);
-      next = _item_reader_next_impl(self, src);
+      next = _item_reader_next_bounded(self, src, self->item_end, TAG_ENDITEM);
       assert(next == TOKEN_ATTRIBUTE || next == TOKEN_ENDITEM);
       self->current_item_state =
           next == TOKEN_ATTRIBUTE
@@ -238,7 +586,8 @@ int dicm_item_reader_next_event(struct dicm_item_reader *self,
               : (next == TOKEN_ENDITEM ? STATE_ENDITEM : STATE_INVALID);
       break;
     case STATE_ENDITEM:
-      next = _item_reader_next_impl(self, src);
+      next = _item_reader_next_bounded(self, src, self->sequence_end,
+                                       TAG_ENDSQITEM);
       assert(next == TOKEN_STARTITEM || next == TOKEN_ENDSQITEM);
       self->current_item_state =
           next == TOKEN_STARTITEM
@@ -246,7 +595,7 @@ int dicm_item_reader_next_event(struct dicm_item_reader *self,
               : (next == TOKEN_ENDSQITEM ? STATE_ENDSEQUENCE : STATE_INVALID);
       break;
     case STATE_ENDSEQUENCE:  // re-enter case
-      next = _item_reader_next_impl(self, src);
+      next = _item_reader_next_bounded(self, src, self->item_end, TAG_ENDITEM);
       assert(next == TOKEN_ATTRIBUTE || next == TOKEN_ENDITEM);
       self->current_item_state =
           next == TOKEN_ATTRIBUTE
@@ -270,7 +619,7 @@ static inline enum dicm_token _fragments_reader_next_impl2(
 }
 
 static enum dicm_token _fragments_reader_next_impl(
-    struct dicm_item_reader *self, struct dicm_io *src) {
+    struct dicm_item_reader *self, struct dicm_src *src) {
   const enum dicm_token next = _item_reader_next_impl(self, src);
   return next == TOKEN_STARTITEM ? TOKEN_FRAGMENT : next;
 }
@@ -282,7 +631,7 @@ static enum dicm_token _fragments_reader_next_impl(
  * - STATE_ENDSEQUENCE
  */
 int dicm_fragments_reader_next_event(struct dicm_item_reader *self,
-                                     struct dicm_io *src) {
+                                     struct dicm_src *src) {
   const enum dicm_state current_state = self->current_item_state;
   enum dicm_token next;
   switch (current_state) {
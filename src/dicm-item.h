@@ -7,6 +7,90 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* default read-ahead block size */
+enum { SRC_BLOCK_SIZE = 64 * 1024 };
+
+/* read-ahead buffer in front of the io object, so that element headers and
+ * small values are decoded in place instead of one io call each */
+struct dicm_src {
+  struct dicm_io *io;
+  /* owned block */
+  unsigned char *data;
+  size_t capacity;
+  /* unread bytes, either in data or lent by io */
+  const unsigned char *cur;
+  const unsigned char *end;
+  /* number of bytes pulled from io, up to end */
+  io_offset offset;
+};
+
+bool src_create(struct dicm_src *src, struct dicm_io *io, size_t capacity);
+
+static inline void src_free(struct dicm_src *src) { free(src->data); }
+
+static inline size_t src_available(const struct dicm_src *src) {
+  return (size_t)(src->end - src->cur);
+}
+
+/* current position, as seen by the reader */
+static inline io_offset src_tell(const struct dicm_src *src) {
+  return src->offset - (io_offset)src_available(src);
+}
+
+/* return the number of contiguous bytes available, at least size unless end of
+ * file was reached */
+size_t src_fill(struct dicm_src *src, size_t size);
+
+/* return a view on the next size bytes, NULL if not enough data */
+static inline const void *src_peek(struct dicm_src *src, size_t size) {
+  assert(size <= src->capacity);
+  if (likely(src_available(src) >= size)) return src->cur;
+  return src_fill(src, size) >= size ? src->cur : NULL;
+}
+
+static inline void src_consume(struct dicm_src *src, size_t size) {
+  assert(size <= src_available(src));
+  src->cur += size;
+}
+
+io_ssize src_read(struct dicm_src *src, void *buf, size_t size);
+
+io_offset src_skip(struct dicm_src *src, io_offset off);
+
+/* write the next size bytes to dst, in kernel space when possible */
+io_ssize src_transfer(struct dicm_src *src, struct dicm_io *dst, size_t size);
+
+/* the view is valid until the next call on src */
+bool src_borrow(struct dicm_src *src, const void **buf, size_t size);
+
+/* move src to the end of the undefined length sequence or item it is in, by
+ * walking element headers only: defined lengths are jumped over, nesting is
+ * tracked through undefined lengths and delimiters. Stop right before the
+ * closing delimiter, or right after it when through_end */
+bool src_skip_subtree(struct dicm_src *src, enum dicm_vr_encoding encoding,
+                      bool through_end);
+
+/* how a dataset is encoded, see src_sniff */
+struct dicm_meta {
+  /* Transfer Syntax UID, empty without File Meta Information */
+  char transfer_syntax[65];
+  /* where the File Meta Information ends, -1 without */
+  io_offset end;
+  /* of the dataset, after the File Meta Information if any */
+  enum dicm_vr_encoding encoding;
+  bool deflated;
+};
+
+/* bytes peeked by src_sniff: preamble and DICM prefix */
+enum { SRC_SNIFF_SIZE = 132 };
+
+/* consume the preamble if any, then walk the File Meta Information without
+ * consuming it. Without one, the encoding is guessed from the first
+ * attribute. Fails when the read-ahead block is smaller than SRC_SNIFF_SIZE,
+ * or cannot hold the File Meta Information up to the Transfer Syntax UID
+ * (the whole group without File Meta Information Group Length) */
+bool src_sniff(struct dicm_src *src, struct dicm_meta *meta);
+
 struct dicm_item_reader {
   /* the current item state */
   enum dicm_state current_item_state;
@@ -17,18 +101,26 @@ struct dicm_item_reader {
   /* current pos in value_length */
   uint32_t value_length_pos;
 
+  /* VR and byte order, inherited by nested items */
+  enum dicm_vr_encoding encoding;
+
+  /* sequence readers: where the defined length sequence and its current
+   * defined length item end in src, 0 when undefined */
+  io_offset sequence_end;
+  io_offset item_end;
+
   DICM_CHECK_RETURN int (*fp_next_event)(struct dicm_item_reader *self,
-                                         struct dicm_io *src);
+                                         struct dicm_src *src);
 };
 
 int dicm_ds_reader_next_event(struct dicm_item_reader *self,
-                              struct dicm_io *src);
+                              struct dicm_src *src);
 
 int dicm_item_reader_next_event(struct dicm_item_reader *self,
-                                struct dicm_io *src);
+                                struct dicm_src *src);
 
 int dicm_fragments_reader_next_event(struct dicm_item_reader *self,
-                                     struct dicm_io *src);
+                                     struct dicm_src *src);
 
 struct array {
   size_t size;
@@ -80,3 +172,35 @@ static inline void array_pop_back(struct array *arr) {
   assert(arr->size);
   arr->size--;
 }
+
+struct dicm_filter;
+
+/* reader created by dicm_reader_utf8_create */
+struct _dicm_utf8_reader {
+  struct dicm_reader reader;
+
+  /* data */
+  /* the current state */
+  enum dicm_state current_state;
+
+  /* item readers */
+  struct array item_readers;
+
+  /* read-ahead on top of reader.src */
+  struct dicm_src src;
+
+  /* inlined values, allocated on first use */
+  unsigned char *arena;
+
+  /* see dicm_reader_set_filter, NULL when all events are reported */
+  struct dicm_filter *filter;
+
+  /* see dicm_reader_set_stop_tag */
+  dicm_tag_t stop_tag;
+
+  /* sniff the encoding at start of dataset, unless set by the user */
+  bool detect_encoding;
+  struct dicm_meta meta;
+  /* owned, between reader.src and src for a deflated dataset */
+  struct dicm_io *inflate;
+};
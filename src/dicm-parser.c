@@ -0,0 +1,256 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "dicm-parser.h"
+
+#include "dicm-io.h"
+#include "dicm-item.h"
+#include "dicm-private.h"
+#include "dicm-reader.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* io over the bytes fed so far, never blocks: reading past them returns a
+ * short count, as at end of file */
+struct _feed {
+  struct dicm_io io;
+  /* data */
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+  size_t pos;
+};
+
+struct dicm_parser {
+  struct _feed feed;
+  /* the state machine runs unchanged on top of feed */
+  struct _dicm_utf8_reader *reader;
+  bool finished;
+  /* value bytes reported so far end there, see dicm_parser_feed */
+  io_offset value_end;
+};
+
+static DICM_CHECK_RETURN int _feed_destroy(void *self_) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _feed_read(void *self_, void *buf,
+                                             size_t size) DICM_NONNULL;
+static DICM_CHECK_RETURN io_offset _feed_skip(void *self_,
+                                              io_offset off) DICM_NONNULL;
+static DICM_CHECK_RETURN io_ssize _feed_write(void *self_, void const *buf,
+                                              size_t size) DICM_NONNULL;
+
+static struct io_vtable const g_feed_vtable = {
+    /* object interface */
+    .object = {.fp_destroy = _feed_destroy},
+    /* io interface */
+    .io = {.fp_read = _feed_read,
+           .fp_skip = _feed_skip,
+           .fp_write = _feed_write}};
+
+int _feed_destroy(void *self_) {
+  struct _feed *self = (struct _feed *)self_;
+  free(self->data);
+  return 0;
+}
+
+io_ssize _feed_read(void *self_, void *buf, size_t size) {
+  struct _feed *self = (struct _feed *)self_;
+  const size_t remaining = self->size - self->pos;
+  const size_t read = size < remaining ? size : remaining;
+  memcpy(buf, self->data + self->pos, read);
+  self->pos += read;
+  return (io_ssize)read;
+}
+
+io_offset _feed_skip(void *self_, io_offset off) {
+  struct _feed *self = (struct _feed *)self_;
+  /* consumed bytes are gone, see _feed_append */
+  if (off < 0 || (size_t)off > self->size - self->pos) return -1;
+  self->pos += (size_t)off;
+  return (io_offset)self->pos;
+}
+
+io_ssize _feed_write(DICM_UNUSED void *self_, DICM_UNUSED void const *buf,
+                     DICM_UNUSED size_t size) {
+  /* read-only */
+  return -1;
+}
+
+static int _feed_append(struct _feed *self, const void *buf, size_t len) {
+  /* drop what the reader consumed already */
+  const size_t remaining = self->size - self->pos;
+  memmove(self->data, self->data + self->pos, remaining);
+  self->size = remaining;
+  self->pos = 0;
+  if (self->size + len > self->capacity) {
+    size_t capacity = self->capacity ? self->capacity : 4096;
+    while (capacity < self->size + len) capacity *= 2;
+    unsigned char *data = realloc(self->data, capacity);
+    if (!data) return 1;
+    self->data = data;
+    self->capacity = capacity;
+  }
+  memcpy(self->data + self->size, buf, len);
+  self->size += len;
+  return 0;
+}
+
+/* bytes fed but not yet consumed by the reader */
+static inline size_t _parser_available(const struct dicm_parser *self) {
+  return src_available(&self->reader->src) + self->feed.size - self->feed.pos;
+}
+
+/* whether the next element header is complete, so that the item readers never
+ * see a truncated one */
+static bool _parser_header_ready(struct dicm_parser *self) {
+  struct dicm_src *src = &self->reader->src;
+  const void *header = src_peek(src, 8);
+  if (!header) return false;
+  union _ude ude;
+  memcpy(ude.bytes, header, 8);
+  switch (_ide_get_tag(&ude)) {
+    case TAG_STARTITEM:
+    case TAG_ENDITEM:
+    case TAG_ENDSQITEM:
+      return true;
+  }
+  if (array_at(&self->reader->item_readers, 0)->encoding == DICM_VR_IMPLICIT) {
+    return true;
+  }
+  return _is_vr16(_ede16_get_vr(&ude)) || src_peek(src, 12) != NULL;
+}
+
+/* mark the value bytes available now as reported, return their number */
+static size_t _parser_value_piece(struct dicm_parser *self) {
+  struct _dicm_utf8_reader *reader = self->reader;
+  const struct dicm_item_reader *item_reader =
+      array_back(&reader->item_readers);
+  const size_t remaining = item_reader->da.vl - item_reader->value_length_pos;
+  const size_t available = _parser_available(self);
+  const size_t len = remaining < available ? remaining : available;
+  self->value_end = src_tell(&reader->src) + (io_offset)len;
+  return len;
+}
+
+int dicm_parser_create(struct dicm_parser **pself) {
+  struct dicm_parser *self = (struct dicm_parser *)malloc(sizeof(*self));
+  if (self) {
+    self->feed.io.vtable = &g_feed_vtable;
+    self->feed.data = NULL;
+    self->feed.size = self->feed.capacity = self->feed.pos = 0;
+    self->finished = false;
+    self->value_end = 0;
+    struct dicm_reader *reader;
+    if (dicm_reader_utf8_create(&reader, &self->feed.io) == 0) {
+      self->reader = (struct _dicm_utf8_reader *)reader;
+      /* detection would need more bytes than fed at start of dataset, see
+       * dicm_parser_set_vr_encoding */
+      (void)dicm_reader_set_vr_encoding(reader, DICM_VR_EXPLICIT);
+      *pself = self;
+      return 0;
+    }
+    free(self);
+  }
+  *pself = NULL;
+  return 1;
+}
+
+int dicm_parser_destroy(struct dicm_parser *self) {
+  int res = object_destroy(&self->reader->reader);
+  res |= object_destroy(&self->feed.io);
+  free(self);
+  return res;
+}
+
+int dicm_parser_set_vr_encoding(struct dicm_parser *self, int encoding) {
+  /* before the first event */
+  if (self->reader->current_state != STATE_INIT) return 1;
+  return dicm_reader_set_vr_encoding(&self->reader->reader, encoding);
+}
+
+int dicm_parser_feed(struct dicm_parser *self, const void *buf, size_t len) {
+  if (len && (self->finished || _feed_append(&self->feed, buf, len))) {
+    return -1;
+  }
+  struct _dicm_utf8_reader *reader = self->reader;
+  switch (reader->current_state) {
+    case STATE_INVALID:
+    case STATE_ENDDATASET:
+      return -1;
+    case STATE_INIT:
+    case STATE_ATTRIBUTE:
+    case STATE_FRAGMENT:
+      /* next event is decoded from what is known already */
+      break;
+    case STATE_VALUE: {
+      /* skip the reported bytes that the user did not consume */
+      struct dicm_item_reader *item_reader = array_back(&reader->item_readers);
+      const io_offset pos = src_tell(&reader->src);
+      if (pos < self->value_end) {
+        const io_offset to_skip = self->value_end - pos;
+        if (src_skip(&reader->src, to_skip) < 0) return -1;
+        item_reader->value_length_pos += (uint32_t)to_skip;
+      }
+      /* value spanning several feeds: report the next piece */
+      if (item_reader->value_length_pos != item_reader->da.vl) {
+        if (_parser_value_piece(self)) return EVENT_VALUE;
+        /* the rest of the value will never come */
+        return self->finished ? -1 : DICM_PARSER_NEED_MORE_DATA;
+      }
+    }
+      /* fall through */
+    default:
+      if (!_parser_header_ready(self)) {
+        if (!self->finished) return DICM_PARSER_NEED_MORE_DATA;
+        /* only the end of the stream may end the root dataset */
+        if (_parser_available(self)) return -1;
+      }
+  }
+  const int next = dicm_reader_next_event(&reader->reader);
+  if (next == EVENT_VALUE) (void)_parser_value_piece(self);
+  return next;
+}
+
+int dicm_parser_finish(struct dicm_parser *self) {
+  self->finished = true;
+  return 0;
+}
+
+int dicm_parser_get_attribute(struct dicm_parser *self,
+                              struct dicm_attribute *da) {
+  return dicm_reader_get_attribute(&self->reader->reader, da);
+}
+
+size_t dicm_parser_read_value(struct dicm_parser *self, void *buf,
+                              size_t size) {
+  struct _dicm_utf8_reader *reader = self->reader;
+  if (reader->current_state != STATE_VALUE) return 0;
+  struct dicm_item_reader *item_reader = array_back(&reader->item_readers);
+  const size_t remaining = item_reader->da.vl - item_reader->value_length_pos;
+  const size_t available = _parser_available(self);
+  size_t len = size < remaining ? size : remaining;
+  if (available < len) len = available;
+  /* cannot be short, the bytes are there */
+  if (src_read(&reader->src, buf, len) != (io_ssize)len) return 0;
+  item_reader->value_length_pos += (uint32_t)len;
+  return len;
+}
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: LGPLv3 */
+#pragma once
+
+#include "dicm-public.h"
+
+#include <stddef.h> /* size_t */
+
+/* incremental parser: bytes are pushed as they arrive (socket in an event
+ * loop...) instead of being pulled from an io object, so that it never blocks.
+ * Only the bytes not yet consumed are kept, large values are never buffered as
+ * a whole */
+struct dicm_parser;
+
+/* returned by dicm_parser_feed when no event can be decoded from the bytes fed
+ * so far */
+enum { DICM_PARSER_NEED_MORE_DATA = -2 };
+
+DICM_EXPORT int dicm_parser_create(struct dicm_parser **pself);
+
+DICM_EXPORT int dicm_parser_destroy(struct dicm_parser *self);
+
+/* the stream is a dataset in Explicit VR Little Endian by default: neither the
+ * encoding nor a preamble and File Meta Information are detected. Select
+ * another encoding (see dicm_reader_set_vr_encoding) before the first call
+ * to dicm_parser_feed */
+DICM_EXPORT int dicm_parser_set_vr_encoding(struct dicm_parser *self,
+                                            int encoding);
+
+/* append len bytes (none when len is 0), then return the next event,
+ * DICM_PARSER_NEED_MORE_DATA, or -1 on invalid data. Call with no bytes until
+ * DICM_PARSER_NEED_MORE_DATA to drain all the events.
+ * A value spanning several feeds is reported with one EVENT_VALUE per piece
+ * that arrived, the bytes of a piece that are not read are skipped */
+DICM_EXPORT int dicm_parser_feed(struct dicm_parser *self, const void *buf,
+                                 size_t len);
+
+/* no more bytes will be fed. The root dataset ends with the stream, hence the
+ * last events of a stream are only reported after this call. A stream cut
+ * within an element header or value is then invalid data (-1) */
+DICM_EXPORT int dicm_parser_finish(struct dicm_parser *self);
+
+/* valid after EVENT_ATTRIBUTE, EVENT_FRAGMENT and EVENT_VALUE */
+DICM_EXPORT int dicm_parser_get_attribute(struct dicm_parser *self,
+                                          struct dicm_attribute *da);
+
+/* after EVENT_VALUE: copy up to size bytes of the value from what was fed so
+ * far, and return their number */
+DICM_EXPORT size_t dicm_parser_read_value(struct dicm_parser *self, void *buf,
+                                          size_t size);
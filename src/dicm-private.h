@@ -65,33 +65,40 @@ union _ude {
   struct _ide ide;      // implicit data element (8 bytes)
 };
 
+static inline uint16_t _dicm_bswap16(const uint16_t v) {
+  return (uint16_t)(v << 8u | v >> 8u);
+}
+static inline uint32_t _dicm_bswap32(const uint32_t v) {
+  return (v << 24u) | ((v << 8u) & 0xff0000u) | ((v >> 8u) & 0xff00u) |
+         (v >> 24u);
+}
+
+/* Explicit VR Big Endian (retired): tag and VL are stored most significant
+ * byte first, the VR is a pair of characters in both byte orders */
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-#define SWAP_TAG(t) t = (t >> 16) | (t >> 16)
+#define _dicm_from_be16(v) _dicm_bswap16(v)
+#define _dicm_from_be32(v) _dicm_bswap32(v)
 #else
-#error
+#error "little endian hosts only"
 #endif
 
 static inline uint32_t _ide_get_tag(const union _ude *ude) {
-  // byte-swap tag:
-  union {
-    uint32_t t;
-    uint16_t a[2];
-  } u;
-  u.t = ude->ide.tag;
-  return (uint32_t)(u.a[0] << 16u | u.a[1]);
+  // group and element are stored in that order:
+  const uint32_t t = ude->ide.tag;
+  return t << 16u | t >> 16u;
 }
 static inline void _ide_set_tag(union _ude *ude, const uint32_t tag) {
-  // byte-swap tag:
-  union {
-    uint32_t t;
-    uint16_t a[2];
-  } u;
-  u.t = tag;
-  ude->ide.tag = (uint32_t)(u.a[0] << 16u | u.a[1]);
+  ude->ide.tag = tag << 16u | tag >> 16u;
+}
+static inline uint32_t _ide_get_tag_be(const union _ude *ude) {
+  return _dicm_from_be32(ude->ide.tag);
 }
 static inline uint32_t _ide_get_vl(const union _ude *ude) {
   return ude->ide.vl;
 }
+static inline uint32_t _ide_get_vl_be(const union _ude *ude) {
+  return _dicm_from_be32(ude->ide.vl);
+}
 static inline void _ide_set_vl(union _ude *ude, const uint32_t vl) {
   ude->ide.vl = vl;
 }
@@ -110,6 +117,9 @@ static inline void _ede32_set_vr(union _ude *ude, const uint32_t vr) {
 static inline uint32_t _ede16_get_vl(const union _ude *ude) {
   return ude->ede16.vl16;
 }
+static inline uint32_t _ede16_get_vl_be(const union _ude *ude) {
+  return _dicm_from_be16(ude->ede16.vl16);
+}
 
 static inline void _ede16_set_vl(union _ude *ude, const uint32_t vl) {
   assert(vl <= UINT16_MAX);
@@ -119,6 +129,9 @@ static inline void _ede16_set_vl(union _ude *ude, const uint32_t vl) {
 static inline uint32_t _ede32_get_vl(const union _ude *ude) {
   return ude->ede32.vl;
 }
+static inline uint32_t _ede32_get_vl_be(const union _ude *ude) {
+  return _dicm_from_be32(ude->ede32.vl);
+}
 static inline void _ede32_set_vl(union _ude *ude, const uint32_t vl) {
   ude->ede32.vl = vl;
 }
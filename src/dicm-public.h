@@ -109,6 +109,7 @@ static inline dicm_tag_t dicm_tag_set_element(const dicm_tag_t tag,
 }
 
 enum SPECIAL_TAGS {
+  TAG_TRANSFERSYNTAX = MAKE_TAG(0x0002, 0x0010),
   TAG_PIXELDATA = MAKE_TAG(0x7fe0, 0x0010),
   TAG_STARTITEM = MAKE_TAG(0xfffe, 0xe000),
   TAG_ENDITEM = MAKE_TAG(0xfffe, 0xe00d),
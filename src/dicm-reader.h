@@ -15,6 +15,11 @@ struct reader_prv_vtable {
   int (*fp_get_value_length)(void *const, size_t *);
   int (*fp_read_value)(void *const, void *, size_t);
   int (*fp_skip_value)(void *const, size_t);
+  /* zero-copy variant of fp_read_value, the view is valid until the next call
+   * on the reader */
+  int (*fp_borrow_value)(void *const, const void **, size_t);
+  /* pass the value through to dst unchanged, kernel-assisted when possible */
+  int (*fp_transfer_value)(void *const, struct dicm_io *, size_t);
 
   /* We need a start model to implement easy conversion to XML */
   int (*fp_get_encoding)(void *const, char *, size_t);
@@ -41,6 +46,10 @@ struct dicm_reader {
   ((t)->vtable->reader.fp_read_value((t), (b), (s)))
 #define dicm_reader_skip_value(t, s) \
   ((t)->vtable->reader.fp_skip_value((t), (s)))
+#define dicm_reader_borrow_value(t, b, s) \
+  ((t)->vtable->reader.fp_borrow_value((t), (b), (s)))
+#define dicm_reader_transfer_value(t, d, s) \
+  ((t)->vtable->reader.fp_transfer_value((t), (d), (s)))
 #define dicm_reader_get_encoding(t, e, s) \
   ((t)->vtable->reader.fp_get_encoding((t), (e), (s)))
 
@@ -50,7 +59,162 @@ DICM_EXPORT bool dicm_reader_hasnext(const struct dicm_reader *);
 /* return the next event */
 DICM_EXPORT int dicm_reader_next_event(struct dicm_reader *);
 
+/* after EVENT_ATTRIBUTE, EVENT_START_SEQUENCE or EVENT_START_ITEM: leave out
+ * what is nested under the event, as with DICM_PARSE_SKIP. Defined lengths are
+ * seeked over, undefined length sequences and items are crossed by walking
+ * element headers, without decoding events. Not available with a filter */
+DICM_EXPORT int dicm_reader_skip_subtree(struct dicm_reader *self);
+
+/* host types of dicm_reader_read_values */
+enum dicm_value_type {
+  /* US, OW */
+  DICM_VALUE_UINT16 = 0,
+  /* SS */
+  DICM_VALUE_INT16 = 1,
+  /* UL, OL */
+  DICM_VALUE_UINT32 = 2,
+  /* SL */
+  DICM_VALUE_INT32 = 3,
+  /* FL, OF */
+  DICM_VALUE_FLOAT32 = 4,
+  /* FD, OD */
+  DICM_VALUE_FLOAT64 = 5
+};
+
+/* after EVENT_VALUE of a binary value (VRs above): read up to n elements of
+ * the value to values, as an array of type, and store their number in count,
+ * 0 at the end of the value. type is either the type of the VR, or a wider
+ * one: US and SS to DICM_VALUE_INT32, anything to DICM_VALUE_FLOAT64.
+ * values holds n elements of type. Big endian words are swapped and elements
+ * widened a vector register at a time where available */
+DICM_EXPORT int dicm_reader_read_values(struct dicm_reader *self, int type,
+                                        void *values, size_t n, size_t *count);
+
+/* one event, as returned by dicm_reader_next_events */
+struct dicm_event_rec {
+  enum dicm_event event;
+  /* EVENT_ATTRIBUTE, EVENT_FRAGMENT and EVENT_VALUE only */
+  struct dicm_attribute da;
+  /* EVENT_VALUE only: the da.vl bytes of a small value, or NULL when the value
+   * was left for the value accessors */
+  const void *value;
+};
+
+/* decode up to n events at once and return their number, or -1 on error. The
+ * batch stops early after the end of dataset, or after a value too large to be
+ * inlined, which the caller then consumes as with dicm_reader_next_event.
+ * Inlined values are valid until the next call on the reader */
+DICM_EXPORT int dicm_reader_next_events(struct dicm_reader *,
+                                        struct dicm_event_rec *out, size_t n);
+
+/* push mode, handler return values */
+enum dicm_parse_result {
+  DICM_PARSE_CONTINUE = 0,
+  /* do not report the events nested under this one: the value or sequence of
+   * an attribute or fragment, the content of a sequence or item (its end event
+   * is still reported) */
+  DICM_PARSE_SKIP = 1,
+  /* return from dicm_reader_parse, the reader can be resumed later */
+  DICM_PARSE_STOP = 2
+};
+
+/* push mode handlers, one per event. Any of them may be NULL. A negative
+ * return value aborts parsing */
+struct dicm_handlers {
+  int (*start_dataset)(void *ctx, const char *encoding);
+  int (*end_dataset)(void *ctx);
+  int (*attribute)(void *ctx, const struct dicm_attribute *da);
+  int (*fragment)(void *ctx);
+  /* consume the value with the reader accessors, any unread part is skipped */
+  int (*value)(void *ctx, struct dicm_reader *reader, size_t size);
+  int (*start_item)(void *ctx);
+  int (*end_item)(void *ctx);
+  int (*start_sequence)(void *ctx);
+  int (*end_sequence)(void *ctx);
+};
+
+/* run the reader to the end of dataset, reporting events to handlers. Returns
+ * 0 at end of dataset, DICM_PARSE_STOP when a handler stopped, -1 on invalid
+ * data or when a handler failed */
+DICM_EXPORT int dicm_reader_parse(struct dicm_reader *,
+                                  const struct dicm_handlers *handlers,
+                                  void *ctx);
+
 DICM_EXPORT int dicm_reader_create(struct dicm_reader **pself,
                                    struct dicm_io *src, const char *encoding);
 DICM_EXPORT int dicm_reader_utf8_create(struct dicm_reader **pself,
                                         struct dicm_io *src);
+
+/* how the VR of attributes is encoded, and in which byte order */
+enum dicm_vr_encoding {
+  DICM_VR_EXPLICIT = 0,
+  DICM_VR_IMPLICIT = 1,
+  /* Explicit VR Big Endian (retired) */
+  DICM_VR_EXPLICIT_BE = 2
+};
+
+/* encoding of the next attributes of the root dataset and of everything nested
+ * in them. Implicit VRs are resolved with a data
+ * dictionary subset, unknown attributes are reported as UN, or SQ when of
+ * undefined length. Can be changed between attributes of the root dataset.
+ * By default the encoding is detected at start of dataset: a 128 bytes
+ * preamble followed by DICM is skipped, the File Meta Information is reported
+ * as the first attributes of the root dataset, and its Transfer Syntax UID
+ * selects the encoding of the attributes that follow. Without File Meta
+ * Information the encoding is guessed from the first attribute. Setting the
+ * encoding turns detection off.
+ * With DICM_VR_EXPLICIT_BE the words of binary values (US, UL, FL, OW, FD...)
+ * are swapped to little endian as they are read, by dicm_reader_read_value in
+ * whole words only, and by dicm_reader_next_events. Such values cannot be
+ * borrowed nor transferred */
+DICM_EXPORT int dicm_reader_set_vr_encoding(struct dicm_reader *self,
+                                            int encoding);
+
+/* Transfer Syntax UID of the File Meta Information, without padding. Valid
+ * after EVENT_START_DATASET, fails when there is no File Meta Information or
+ * when size is too small */
+DICM_EXPORT int dicm_reader_get_transfer_syntax(struct dicm_reader *self,
+                                                char *uid, size_t size);
+
+/* size of the read-ahead block, 64KB by default. 64KB to 1MB is a good range,
+ * 132 bytes (preamble and DICM prefix) is the minimum. Must be called before
+ * the first event */
+DICM_EXPORT int dicm_reader_set_block_size(struct dicm_reader *self,
+                                           size_t size);
+
+/* tag path: the tags from the root dataset down to an attribute. Each step but
+ * the last goes through one item of a sequence, numbered from 1, or through
+ * all of them */
+enum { DICM_ANY_ITEM = 0 };
+
+struct dicm_path_step {
+  dicm_tag_t tag;
+  uint32_t item;
+};
+
+struct dicm_tag_path {
+  const struct dicm_path_step *steps;
+  size_t size;
+};
+
+/* only report the attributes at the end of paths, with their whole subtree,
+ * and the sequences and items leading to them. Everything else is seeked over
+ * when its length is defined. Must be called before the first event, paths
+ * are copied */
+DICM_EXPORT int dicm_reader_set_filter(struct dicm_reader *self,
+                                       const struct dicm_tag_path *paths,
+                                       size_t npaths);
+
+/* no attribute has this tag, the default stop tag */
+enum { DICM_NO_STOP_TAG = 0xffffffff };
+
+/* end the dataset at the first attribute of the root dataset with a tag at or
+ * above tag, which is not reported: EVENT_END_DATASET comes instead. Nothing
+ * past its header is read. Must be called before the first event */
+DICM_EXPORT int dicm_reader_set_stop_tag(struct dicm_reader *self,
+                                         dicm_tag_t tag);
+
+/* header only: stop at Pixel Data (7FE0,0010), and advise the io that only
+ * the first read-ahead block matters (see DICM_IO_ADVICE_HEADER_ONLY). Must be
+ * called before the first event */
+DICM_EXPORT int dicm_reader_set_header_only(struct dicm_reader *self);
@@ -0,0 +1,141 @@
+/*
+ *  DICM, a library for reading DICOM instances
+ *
+ *  Copyright (c) 2020 Mathieu Malaterre
+ *  All rights reserved.
+ *
+ *  DICM is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  DICM is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with DICM . If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "dicm-swap.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* scalar tails, memcpy keeps them free of alignment and aliasing issues and
+ * compiles down to a load, a bswap and a store */
+static void _bswap16_scalar(unsigned char *p, size_t n) {
+  for (size_t i = 0; i < n; ++i, p += 2) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    v = (uint16_t)(v << 8u | v >> 8u);
+    memcpy(p, &v, 2);
+  }
+}
+
+static void _bswap32_scalar(unsigned char *p, size_t n) {
+  for (size_t i = 0; i < n; ++i, p += 4) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    v = (v << 24u) | ((v << 8u) & 0xff0000u) | ((v >> 8u) & 0xff00u) |
+        (v >> 24u);
+    memcpy(p, &v, 4);
+  }
+}
+
+static void _bswap64_scalar(unsigned char *p, size_t n) {
+  for (size_t i = 0; i < n; ++i, p += 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + 4, 4);
+    _bswap32_scalar((unsigned char *)&lo, 1);
+    _bswap32_scalar((unsigned char *)&hi, 1);
+    memcpy(p, &hi, 4);
+    memcpy(p + 4, &lo, 4);
+  }
+}
+
+#if defined(__SSSE3__)
+/* one byte shuffle per 16 bytes */
+static size_t _bswap_vector(unsigned char *p, size_t size, size_t width) {
+  static const unsigned char masks[3][16] = {
+      {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14},
+      {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+      {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8}};
+  const size_t m = width == 2 ? 0 : width == 4 ? 1 : 2;
+  const __m128i mask =
+      _mm_loadu_si128((const __m128i *)(const void *)masks[m]);
+  size_t done = 0;
+  for (; size - done >= 16; done += 16) {
+    __m128i *q = (__m128i *)(void *)(p + done);
+    _mm_storeu_si128(q, _mm_shuffle_epi8(_mm_loadu_si128(q), mask));
+  }
+  return done;
+}
+#elif defined(__SSE2__)
+/* swap the bytes of 16-bit lanes, then the lanes of wider words */
+static size_t _bswap_vector(unsigned char *p, size_t size, size_t width) {
+  size_t done = 0;
+  for (; size - done >= 16; done += 16) {
+    __m128i *q = (__m128i *)(void *)(p + done);
+    __m128i v = _mm_loadu_si128(q);
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    if (width == 4) {
+      v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+      v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    } else if (width == 8) {
+      v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+      v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    }
+    _mm_storeu_si128(q, v);
+  }
+  return done;
+}
+#elif defined(__ARM_NEON)
+static size_t _bswap_vector(unsigned char *p, size_t size, size_t width) {
+  size_t done = 0;
+  for (; size - done >= 16; done += 16) {
+    const uint8x16_t v = vld1q_u8(p + done);
+    vst1q_u8(p + done, width == 2   ? vrev16q_u8(v)
+                       : width == 4 ? vrev32q_u8(v)
+                                    : vrev64q_u8(v));
+  }
+  return done;
+}
+#else
+static size_t _bswap_vector(DICM_UNUSED unsigned char *p,
+                            DICM_UNUSED size_t size,
+                            DICM_UNUSED size_t width) {
+  return 0;
+}
+#endif
+
+void bswap_words(void *buf, size_t size, size_t width) {
+  assert(width == 2 || width == 4 || width == 8);
+  assert(size % width == 0);
+  unsigned char *p = buf;
+  /* 16 is a multiple of every width, words never straddle the tail */
+  const size_t done = _bswap_vector(p, size, width);
+  p += done;
+  const size_t n = (size - done) / width;
+  switch (width) {
+    case 2:
+      _bswap16_scalar(p, n);
+      break;
+    case 4:
+      _bswap32_scalar(p, n);
+      break;
+    default:
+      _bswap64_scalar(p, n);
+  }
+}
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: LGPLv3 */
+#pragma once
+
+#include "dicm-public.h"
+
+#include <stddef.h> /* size_t */
+
+/* size of the binary words of a value, which are byte-swapped when read from
+ * a big endian dataset, 0 for byte strings and text */
+static inline size_t vr_swap_width(const dicm_vr_t vr) {
+  switch (vr) {
+    case VR_AT: /* pairs of group and element */
+    case VR_OW:
+    case VR_SS:
+    case VR_US:
+      return 2;
+    case VR_FL:
+    case VR_OF:
+    case VR_OL:
+    case VR_SL:
+    case VR_UL:
+      return 4;
+    case VR_FD:
+    case VR_OD:
+    case VR_OV:
+    case VR_SV:
+    case VR_UV:
+      return 8;
+  }
+  return 0;
+}
+
+/* reverse the bytes of every word of buf in place. size is a multiple of
+ * width, which is 2, 4 or 8. Whole vector registers are swapped at a time
+ * where available, so that it runs close to memory bandwidth */
+void bswap_words(void *buf, size_t size, size_t width);
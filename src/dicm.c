@@ -18,27 +18,29 @@
  *  <http://www.gnu.org/licenses/>.
  *
  */
+#include "dicm-convert.h"
+#include "dicm-deflate.h"
+#include "dicm-filter.h"
 #include "dicm-item.h"
 #include "dicm-private.h"
 #include "dicm-public.h"
 #include "dicm-reader.h"
+#include "dicm-swap.h"
 
 #include <assert.h>
+#include <limits.h> /* INT_MAX */
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
 static const char dicm_utf8[] = "UTF-8";
 
-struct _dicm_utf8_reader {
-  struct dicm_reader reader;
-
-  /* data */
-  /* the current state */
-  enum dicm_state current_state;
-
-  /* item readers */
-  struct array item_readers;
+enum {
+  /* values up to this size are copied along with their event, see
+   * dicm_reader_next_events */
+  INLINE_VALUE_MAX = 1024,
+  /* storage for the inlined values of one batch */
+  INLINE_ARENA_SIZE = 16 * 1024
 };
 
 static DICM_CHECK_RETURN int _dicm_utf8_reader_destroy(void *self_)
@@ -52,6 +54,10 @@ static DICM_CHECK_RETURN int _dicm_utf8_reader_read_value(void *const, void *,
                                                           size_t) DICM_NONNULL;
 static DICM_CHECK_RETURN int _dicm_utf8_reader_skip_value(void *const,
                                                           size_t) DICM_NONNULL;
+static DICM_CHECK_RETURN int _dicm_utf8_reader_borrow_value(
+    void *const, const void **, size_t) DICM_NONNULL;
+static DICM_CHECK_RETURN int _dicm_utf8_reader_transfer_value(
+    void *const, struct dicm_io *, size_t) DICM_NONNULL;
 static DICM_CHECK_RETURN int _dicm_utf8_reader_get_encoding(
     void *const, char *, size_t) DICM_NONNULL;
 
@@ -63,6 +69,8 @@ static struct reader_vtable const g_vtable = {
                .fp_get_value_length = _dicm_utf8_reader_get_value_length,
                .fp_read_value = _dicm_utf8_reader_read_value,
                .fp_skip_value = _dicm_utf8_reader_skip_value,
+               .fp_borrow_value = _dicm_utf8_reader_borrow_value,
+               .fp_transfer_value = _dicm_utf8_reader_transfer_value,
                .fp_get_encoding = _dicm_utf8_reader_get_encoding}};
 
 bool dicm_reader_hasnext(const struct dicm_reader *self_) {
@@ -118,12 +126,18 @@ static inline struct dicm_item_reader *get_item_reader(
 }
 
 static inline void push_item_reader(struct array *item_readers,
-                                    const enum dicm_state current_state) {
+                                    const enum dicm_state current_state,
+                                    const struct dicm_src *src) {
   assert(current_state == STATE_STARTSEQUENCE);
   assert(array_back(item_readers)->current_item_state == current_state);
 
+  // the sequence attribute is still in the parent reader:
+  const dicm_vl_t vl = array_back(item_readers)->da.vl;
   struct dicm_item_reader new_item = {
       .current_item_state = current_state,
+      .encoding = array_back(item_readers)->encoding,
+      .sequence_end =
+          dicm_vl_is_undefined(vl) ? 0 : src_tell(src) + (io_offset)vl,
       .fp_next_event = dicm_item_reader_next_event};
   array_push_back(item_readers, &new_item);
 }
@@ -135,6 +149,7 @@ static inline void push_fragments_reader(struct array *item_readers,
 
   struct dicm_item_reader new_item = {
       .current_item_state = current_state,
+      .encoding = array_back(item_readers)->encoding,
       .fp_next_event = dicm_fragments_reader_next_event};
   array_push_back(item_readers, &new_item);
 }
@@ -150,19 +165,66 @@ static inline void pop_item_reader(struct array *item_readers,
   item_reader->current_item_state = current_state;  // re-initialize
 }
 
-int dicm_reader_next_event(struct dicm_reader *self_) {
-  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+/* see dicm_reader_set_vr_encoding */
+static int _dicm_utf8_reader_sniff(struct _dicm_utf8_reader *self) {
+  if (!src_sniff(&self->src, &self->meta)) return 1;
+  /* File Meta Information first, see _dicm_utf8_reader_end_meta */
+  if (self->meta.end < 0) {
+    array_back(&self->item_readers)->encoding = self->meta.encoding;
+  }
+  return 0;
+}
+
+/* the dataset following the File Meta Information has its own encoding */
+static int _dicm_utf8_reader_end_meta(struct _dicm_utf8_reader *self) {
+  assert(is_root_dataset(self));
+  self->meta.end = -1;
+  array_back(&self->item_readers)->encoding = self->meta.encoding;
+  if (self->meta.deflated) {
+    /* the compressed bytes read ahead already come first */
+    struct dicm_io *inflate;
+    if (inflate_io_create(&inflate, self->src.io, DICM_DEFLATE_RAW,
+                          self->src.cur, src_available(&self->src))) {
+      return 1;
+    }
+    struct dicm_src src;
+    if (!src_create(&src, inflate, self->src.capacity)) {
+      (void)object_destroy(inflate);
+      return 1;
+    }
+    src_free(&self->src);
+    self->src = src;
+    self->inflate = inflate;
+  }
+  return 0;
+}
+
+static inline int _dicm_utf8_reader_step(struct _dicm_utf8_reader *self) {
   const enum dicm_state current_state = self->current_state;
 #if 1
   // special init case
   if (current_state == STATE_INIT) {
+    if (self->detect_encoding && _dicm_utf8_reader_sniff(self)) {
+      self->current_state = STATE_INVALID;
+      return -1;
+    }
     self->current_state = STATE_STARTDATASET;
     return EVENT_START_DATASET;
   }
   // else get next dicm token:
   switch (current_state) {
+    case STATE_VALUE: {
+      // skip whatever the user did not consume:
+      const struct dicm_item_reader *value_reader =
+          array_back(&self->item_readers);
+      if (value_reader->value_length_pos != value_reader->da.vl &&
+          _dicm_utf8_reader_skip_value(self, VL_UNDEFINED)) {
+        self->current_state = STATE_INVALID;
+        return -1;
+      }
+    } break;
     case STATE_STARTSEQUENCE:
-      push_item_reader(&self->item_readers, current_state);
+      push_item_reader(&self->item_readers, current_state, &self->src);
       break;
     case STATE_STARTFRAGMENTS:
       push_fragments_reader(&self->item_readers, current_state);
@@ -172,11 +234,28 @@ int dicm_reader_next_event(struct dicm_reader *self_) {
       break;
     default:;
   }
+  if (unlikely(src_tell(&self->src) == self->meta.end) &&
+      _dicm_utf8_reader_end_meta(self)) {
+    self->current_state = STATE_INVALID;
+    return -1;
+  }
   struct dicm_item_reader *item_reader =
       get_item_reader(&self->item_readers, current_state);
   const enum dicm_token dicm_next =
-      item_reader->fp_next_event(item_reader, self->reader.src);
+      item_reader->fp_next_event(item_reader, &self->src);
+  if (unlikely(dicm_next == TOKEN_INVALID_DATA)) {
+    self->current_state = STATE_INVALID;
+    return -1;
+  }
   const enum dicm_event next = token2event(dicm_next);
+  if (unlikely(next == EVENT_ATTRIBUTE &&
+               item_reader->da.tag >= self->stop_tag &&
+               is_root_dataset(self))) {
+    /* see dicm_reader_set_stop_tag: nothing to unwind at the root level */
+    item_reader->current_item_state = STATE_ENDDATASET;
+    self->current_state = STATE_ENDDATASET;
+    return EVENT_END_DATASET;
+  }
   self->current_state = item_reader->current_item_state;
 #else
   if (current_state == STATE_INIT) {
@@ -337,6 +416,289 @@ int dicm_reader_next_event(struct dicm_reader *self_) {
   return next;
 }
 
+/* leave out the attribute or item just reported (defined length), without
+ * reading it. The end of item is not reported either */
+static int _dicm_utf8_reader_seek(struct _dicm_utf8_reader *self) {
+  struct dicm_item_reader *item_reader = array_back(&self->item_readers);
+  if (self->current_state == STATE_ATTRIBUTE) {
+    /* as a value nobody read, skipped on the next step */
+    item_reader->value_length_pos = 0;
+    item_reader->current_item_state = STATE_VALUE;
+    self->current_state = STATE_VALUE;
+    return 0;
+  }
+  assert(self->current_state == STATE_STARTITEM);
+  if (src_skip(&self->src, item_reader->da.vl) < 0) return 1;
+  item_reader->current_item_state = STATE_ENDITEM;
+  self->current_state = STATE_ENDITEM;
+  return 0;
+}
+
+/* see dicm_reader_skip_subtree */
+static int _dicm_utf8_reader_skip_subtree(struct _dicm_utf8_reader *self) {
+  struct dicm_item_reader *item_reader = array_back(&self->item_readers);
+  const bool undefined = dicm_vl_is_undefined(item_reader->da.vl);
+  const enum dicm_vr_encoding encoding = item_reader->encoding;
+  switch (self->current_state) {
+    case STATE_ATTRIBUTE:
+      if (!undefined) return _dicm_utf8_reader_seek(self);
+      if (!src_skip_subtree(&self->src, encoding, true)) return 1;
+      /* as a value read to the end */
+      item_reader->value_length_pos = item_reader->da.vl;
+      item_reader->current_item_state = STATE_VALUE;
+      self->current_state = STATE_VALUE;
+      return 0;
+    case STATE_STARTITEM:
+      /* the next step reads or synthesizes the end of item */
+      if (undefined) return !src_skip_subtree(&self->src, encoding, false);
+      return src_skip(&self->src, item_reader->item_end -
+                                      src_tell(&self->src)) < 0;
+    case STATE_STARTSEQUENCE:
+      if (undefined) return !src_skip_subtree(&self->src, encoding, false);
+      /* sequence reader after its last item, ends where src is */
+      push_item_reader(&self->item_readers, STATE_STARTSEQUENCE, &self->src);
+      item_reader = array_back(&self->item_readers);
+      if (src_skip(&self->src, item_reader->sequence_end -
+                                   src_tell(&self->src)) < 0) {
+        return 1;
+      }
+      item_reader->current_item_state = STATE_ENDITEM;
+      self->current_state = STATE_ENDITEM;
+      return 0;
+    case STATE_STARTFRAGMENTS:
+      return !src_skip_subtree(&self->src, encoding, false);
+    default:
+      return 1;
+  }
+}
+
+static inline int _dicm_utf8_reader_next_event(
+    struct _dicm_utf8_reader *self) {
+  if (likely(!self->filter)) return _dicm_utf8_reader_step(self);
+  for (;;) {
+    const int next = _dicm_utf8_reader_step(self);
+    if (unlikely(next < 0)) return next;
+    switch (filter_next(self->filter, next,
+                        &array_back(&self->item_readers)->da)) {
+      case FILTER_EMIT:
+        return next;
+      case FILTER_SUPPRESS:
+        break;
+      case FILTER_SEEK:
+        if (_dicm_utf8_reader_seek(self)) {
+          self->current_state = STATE_INVALID;
+          return -1;
+        }
+        break;
+    }
+  }
+}
+
+/* word size of the current value when it is read byte-swapped, 0 otherwise */
+static inline size_t _value_swap_width(
+    const struct dicm_item_reader *item_reader) {
+  if (item_reader->encoding != DICM_VR_EXPLICIT_BE) return 0;
+  return vr_swap_width(item_reader->da.vr);
+}
+
+int dicm_reader_next_event(struct dicm_reader *self_) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  return _dicm_utf8_reader_next_event(self);
+}
+
+int dicm_reader_next_events(struct dicm_reader *self_,
+                            struct dicm_event_rec *out, size_t n) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  if (unlikely(!self->arena)) {
+    self->arena = malloc(INLINE_ARENA_SIZE);
+    if (!self->arena) return -1;
+  }
+  size_t used = 0;
+  size_t count = 0;
+  if (n > INT_MAX) n = INT_MAX;
+  while (count != n && self->current_state != STATE_ENDDATASET) {
+    const int next = _dicm_utf8_reader_next_event(self);
+    if (unlikely(next < 0)) return -1;
+    struct dicm_event_rec *rec = &out[count++];
+    rec->event = (enum dicm_event)next;
+    rec->value = NULL;
+    if (next != EVENT_ATTRIBUTE && next != EVENT_FRAGMENT &&
+        next != EVENT_VALUE) {
+      continue;
+    }
+    struct dicm_item_reader *item_reader = array_back(&self->item_readers);
+    rec->da = item_reader->da;
+    if (next != EVENT_VALUE) continue;
+    const uint32_t vl = item_reader->da.vl;
+    /* leave large values to the caller, which is now in the value state */
+    if (vl > INLINE_VALUE_MAX || vl > INLINE_ARENA_SIZE - used) break;
+    if (src_read(&self->src, self->arena + used, vl) != (io_ssize)vl) {
+      self->current_state = STATE_INVALID;
+      return -1;
+    }
+    item_reader->value_length_pos = vl;
+    const size_t width = _value_swap_width(item_reader);
+    if (width) {
+      if (vl % width) {
+        self->current_state = STATE_INVALID;
+        return -1;
+      }
+      bswap_words(self->arena + used, vl, width);
+    }
+    rec->value = self->arena + used;
+    used += vl;
+  }
+  return (int)count;
+}
+
+static inline int _dicm_utf8_reader_dispatch(
+    struct _dicm_utf8_reader *self, const struct dicm_handlers *handlers,
+    void *ctx, const int next) {
+  switch (next) {
+    case EVENT_START_DATASET:
+      if (handlers->start_dataset) {
+        char encoding[64];
+        if (_dicm_utf8_reader_get_encoding(self, encoding, sizeof encoding))
+          return -1;
+        return handlers->start_dataset(ctx, encoding);
+      }
+      break;
+    case EVENT_END_DATASET:
+      if (handlers->end_dataset) return handlers->end_dataset(ctx);
+      break;
+    case EVENT_ATTRIBUTE:
+      if (handlers->attribute) {
+        return handlers->attribute(ctx, &array_back(&self->item_readers)->da);
+      }
+      break;
+    case EVENT_FRAGMENT:
+      if (handlers->fragment) return handlers->fragment(ctx);
+      break;
+    case EVENT_VALUE:
+      if (handlers->value) {
+        return handlers->value(ctx, &self->reader,
+                               array_back(&self->item_readers)->da.vl);
+      }
+      break;
+    case EVENT_START_ITEM:
+      if (handlers->start_item) return handlers->start_item(ctx);
+      break;
+    case EVENT_END_ITEM:
+      if (handlers->end_item) return handlers->end_item(ctx);
+      break;
+    case EVENT_START_SEQUENCE:
+      if (handlers->start_sequence) return handlers->start_sequence(ctx);
+      break;
+    case EVENT_END_SEQUENCE:
+      if (handlers->end_sequence) return handlers->end_sequence(ctx);
+      break;
+    default:
+      assert(0);
+  }
+  return DICM_PARSE_CONTINUE;
+}
+
+int dicm_reader_parse(struct dicm_reader *self_,
+                      const struct dicm_handlers *handlers, void *ctx) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  /* while skipping: nesting level, and whether the skipped subtree belongs to
+   * an attribute (or fragment), in which case there is no end event to report
+   */
+  bool skipping = false;
+  bool skip_attribute = false;
+  int level = 0;
+  while (self->current_state != STATE_ENDDATASET) {
+    const int next = _dicm_utf8_reader_next_event(self);
+    if (unlikely(next < 0)) return -1;
+    if (skipping) {
+      switch (next) {
+        case EVENT_START_ITEM:
+        case EVENT_START_SEQUENCE:
+          ++level;
+          continue;
+        case EVENT_END_ITEM:
+        case EVENT_END_SEQUENCE:
+          --level;
+          if (level != 0) continue;
+          skipping = false;
+          if (skip_attribute) continue;
+          break;
+        case EVENT_VALUE:
+          if (level == 0) skipping = false;
+          continue;
+        default:
+          continue;
+      }
+    }
+    const int res = _dicm_utf8_reader_dispatch(self, handlers, ctx, next);
+    if (likely(res == DICM_PARSE_CONTINUE)) continue;
+    if (res == DICM_PARSE_STOP) return DICM_PARSE_STOP;
+    if (res != DICM_PARSE_SKIP) return -1;
+    /* jump to the end of the subtree, unless a filter has to see its events.
+     * Other events have no subtree: skipping them does nothing */
+    if (!self->filter &&
+        (next == EVENT_ATTRIBUTE || next == EVENT_START_ITEM ||
+         next == EVENT_START_SEQUENCE)) {
+      if (unlikely(_dicm_utf8_reader_skip_subtree(self))) {
+        self->current_state = STATE_INVALID;
+        return -1;
+      }
+      continue;
+    }
+    switch (next) {
+      case EVENT_ATTRIBUTE:
+      case EVENT_FRAGMENT:
+        skipping = skip_attribute = true;
+        level = 0;
+        break;
+      case EVENT_START_ITEM:
+      case EVENT_START_SEQUENCE:
+        skipping = true;
+        skip_attribute = false;
+        level = 1;
+        break;
+      default:;
+    }
+  }
+  return 0;
+}
+
+int dicm_reader_skip_subtree(struct dicm_reader *self_) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  if (self->filter) return 1;
+  if (self->current_state != STATE_ATTRIBUTE &&
+      self->current_state != STATE_STARTITEM &&
+      self->current_state != STATE_STARTSEQUENCE &&
+      self->current_state != STATE_STARTFRAGMENTS) {
+    return 1;
+  }
+  if (_dicm_utf8_reader_skip_subtree(self)) {
+    self->current_state = STATE_INVALID;
+    return 1;
+  }
+  return 0;
+}
+
+int dicm_reader_read_values(struct dicm_reader *self_, int type, void *values,
+                            size_t n, size_t *count) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  if (self->current_state != STATE_VALUE) return 1;
+  const struct dicm_item_reader *item_reader = array_back(&self->item_readers);
+  const int from = vr_value_type(item_reader->da.vr);
+  if (from < 0 || !value_type_widens(from, type)) return 1;
+  const size_t size = value_type_size(from);
+  const size_t remaining =
+      (item_reader->da.vl - item_reader->value_length_pos) / size;
+  if (n > remaining) n = remaining;
+  /* read at the end of values, widened toward its start */
+  unsigned char *raw =
+      (unsigned char *)values + n * (value_type_size(type) - size);
+  if (n && _dicm_utf8_reader_read_value(self, raw, n * size)) return 1;
+  widen_values(values, n, from, type);
+  *count = n;
+  return 0;
+}
+
 int dicm_reader_create(struct dicm_reader **pself, struct dicm_io *src,
                        const char *encoding) {
   if (strcmp(encoding, dicm_utf8)) {
@@ -346,18 +708,94 @@ int dicm_reader_create(struct dicm_reader **pself, struct dicm_io *src,
   return dicm_reader_utf8_create(pself, src);
 }
 
+int dicm_reader_set_block_size(struct dicm_reader *self_, size_t size) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  // only before anything was read:
+  if (self->current_state != STATE_INIT || size < SRC_SNIFF_SIZE) return 1;
+  struct dicm_src src;
+  if (!src_create(&src, self->reader.src, size)) return 1;
+  src_free(&self->src);
+  self->src = src;
+  return 0;
+}
+
+int dicm_reader_set_filter(struct dicm_reader *self_,
+                           const struct dicm_tag_path *paths, size_t npaths) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  // only before anything was read:
+  if (self->current_state != STATE_INIT) return 1;
+  struct dicm_filter *filter;
+  if (filter_create(&filter, paths, npaths)) return 1;
+  if (self->filter) filter_free(self->filter);
+  self->filter = filter;
+  return 0;
+}
+
+int dicm_reader_set_stop_tag(struct dicm_reader *self_, dicm_tag_t tag) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  // only before anything was read:
+  if (self->current_state != STATE_INIT) return 1;
+  self->stop_tag = tag;
+  return 0;
+}
+
+int dicm_reader_set_header_only(struct dicm_reader *self_) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  if (dicm_reader_set_stop_tag(self_, TAG_PIXELDATA)) return 1;
+  /* the header is expected to fit in the first read-ahead block */
+  return dicm_io_advise(self->reader.src, DICM_IO_ADVICE_HEADER_ONLY,
+                        self->src.capacity) != 0;
+}
+
+int dicm_reader_set_vr_encoding(struct dicm_reader *self_, int encoding) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  // root dataset only, nested items inherit its encoding:
+  if (!is_root_dataset(self) || self->current_state == STATE_INVALID) return 1;
+  if (encoding != DICM_VR_EXPLICIT && encoding != DICM_VR_IMPLICIT &&
+      encoding != DICM_VR_EXPLICIT_BE) {
+    return 1;
+  }
+  array_back(&self->item_readers)->encoding = (enum dicm_vr_encoding)encoding;
+  /* the user knows better */
+  self->detect_encoding = false;
+  self->meta.end = -1;
+  return 0;
+}
+
+int dicm_reader_get_transfer_syntax(struct dicm_reader *self_, char *uid,
+                                    size_t size) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  const char *ts = self->meta.transfer_syntax;
+  const size_t len = strlen(ts);
+  if (len == 0 || len >= size) return 1;
+  memcpy(uid, ts, len + 1);
+  return 0;
+}
+
 int dicm_reader_utf8_create(struct dicm_reader **pself, struct dicm_io *src) {
   struct _dicm_utf8_reader *self =
       (struct _dicm_utf8_reader *)malloc(sizeof(*self));
   if (self) {
+    if (!src_create(&self->src, src, SRC_BLOCK_SIZE)) {
+      free(self);
+      return 1;
+    }
     *pself = &self->reader;
     self->reader.vtable = &g_vtable;
     self->reader.src = src;
     self->current_state = STATE_INIT;
+    self->arena = NULL;
+    self->filter = NULL;
+    self->stop_tag = DICM_NO_STOP_TAG;
+    self->detect_encoding = true;
+    self->meta.transfer_syntax[0] = '\0';
+    self->meta.end = -1;
+    self->inflate = NULL;
     array_create(&self->item_readers, 1);  // TODO: is it a good default ?
     struct dicm_item_reader *item_reader = array_back(&self->item_readers);
     item_reader->current_item_state = STATE_STARTDATASET;
     item_reader->fp_next_event = dicm_ds_reader_next_event;
+    item_reader->encoding = DICM_VR_EXPLICIT;
 
     return 0;
   }
@@ -367,8 +805,13 @@ int dicm_reader_utf8_create(struct dicm_reader **pself, struct dicm_io *src) {
 int _dicm_utf8_reader_destroy(void *self_) {
   struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
   array_free(&self->item_readers);
+  src_free(&self->src);
+  free(self->arena);
+  if (self->filter) filter_free(self->filter);
+  int res = 0;
+  if (self->inflate) res = object_destroy(self->inflate);
   free(self);
-  return 0;
+  return res;
 }
 
 int _dicm_utf8_reader_get_attribute(void *self_, struct dicm_attribute *da) {
@@ -388,20 +831,77 @@ int _dicm_utf8_reader_get_value_length(void *self_, size_t *s) {
 int _dicm_utf8_reader_read_value(void *self_, void *b, size_t s) {
   struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
   struct dicm_item_reader *item_reader = array_back(&self->item_readers);
-  const uint32_t value_length = item_reader->da.vl;
+  const uint32_t remaining =
+      item_reader->da.vl - item_reader->value_length_pos;
   const size_t max_length = s;
   const uint32_t to_read =
-      max_length < (size_t)value_length ? (uint32_t)max_length : value_length;
+      max_length < (size_t)remaining ? (uint32_t)max_length : remaining;
+  /* big endian words are swapped whole */
+  const size_t width = _value_swap_width(item_reader);
+  if (width && (to_read % width || item_reader->value_length_pos % width)) {
+    return 1;
+  }
 
-  struct dicm_io *src = self->reader.src;
-  io_ssize err = dicm_io_read(src, b, to_read);
-  (void)err;
+  const io_ssize err = src_read(&self->src, b, to_read);
+  if (err != (io_ssize)to_read) return 1;
   item_reader->value_length_pos += to_read;
   assert(item_reader->value_length_pos <= item_reader->da.vl);
+  if (width) bswap_words(b, to_read, width);
+
+  return 0;
+}
+
+int _dicm_utf8_reader_skip_value(void *self_, size_t s) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  struct dicm_item_reader *item_reader = array_back(&self->item_readers);
+  const uint32_t remaining =
+      item_reader->da.vl - item_reader->value_length_pos;
+  const size_t max_length = s;
+  const uint32_t to_skip =
+      max_length < (size_t)remaining ? (uint32_t)max_length : remaining;
+
+  const io_offset err = src_skip(&self->src, to_skip);
+  if (err < 0) return 1;
+  item_reader->value_length_pos += to_skip;
+  assert(item_reader->value_length_pos <= item_reader->da.vl);
+
+  return 0;
+}
+
+int _dicm_utf8_reader_borrow_value(void *self_, const void **b, size_t s) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  struct dicm_item_reader *item_reader = array_back(&self->item_readers);
+  const uint32_t remaining =
+      item_reader->da.vl - item_reader->value_length_pos;
+  if (s > remaining) return 1;
+  /* the view would not be swapped, caller should use read_value instead */
+  if (_value_swap_width(item_reader)) return 1;
+
+  /* src cannot lend its storage, caller should use read_value instead */
+  if (!src_borrow(&self->src, b, s)) return 1;
+  item_reader->value_length_pos += (uint32_t)s;
+
+  return 0;
+}
+
+int _dicm_utf8_reader_transfer_value(void *self_, struct dicm_io *dst,
+                                     size_t s) {
+  struct _dicm_utf8_reader *self = (struct _dicm_utf8_reader *)self_;
+  struct dicm_item_reader *item_reader = array_back(&self->item_readers);
+  const uint32_t remaining =
+      item_reader->da.vl - item_reader->value_length_pos;
+  const size_t max_length = s;
+  const uint32_t to_transfer =
+      max_length < (size_t)remaining ? (uint32_t)max_length : remaining;
+  /* bytes are passed through unchanged, hence left big endian */
+  if (_value_swap_width(item_reader)) return 1;
+
+  const io_ssize err = src_transfer(&self->src, dst, to_transfer);
+  if (err != (io_ssize)to_transfer) return 1;
+  item_reader->value_length_pos += to_transfer;
 
   return 0;
 }
-int _dicm_utf8_reader_skip_value(void *self_, size_t s) { assert(0); }
 
 int _dicm_utf8_reader_get_encoding(void *self_, char *c, size_t s) {
   assert(s >= sizeof dicm_utf8);
@@ -0,0 +1,801 @@
+#include "dicm-index.h"
+#include "dicm-io.h"
+#include "dicm-parser.h"
+#include "dicm-reader.h"
+
+#include <stdlib.h> /* EXIT_SUCCESS */
+#include <string.h>
+
+/* explicit little endian, one small value in a sequence, one large value */
+static const unsigned char header[] = {
+    /* (0008,0060) CS 2 */
+    0x08, 0x00, 0x60, 0x00, 'C', 'S', 0x02, 0x00, 'M', 'R',
+    /* (0008,1115) SQ u/l */
+    0x08, 0x00, 0x15, 0x11, 'S', 'Q', 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+    /* item u/l */
+    0xfe, 0xff, 0x00, 0xe0, 0xff, 0xff, 0xff, 0xff,
+    /* (0008,1150) UI 4 */
+    0x08, 0x00, 0x50, 0x11, 'U', 'I', 0x04, 0x00, '1', '.', '2', 0x00,
+    /* item end */
+    0xfe, 0xff, 0x0d, 0xe0, 0x00, 0x00, 0x00, 0x00,
+    /* sequence end */
+    0xfe, 0xff, 0xdd, 0xe0, 0x00, 0x00, 0x00, 0x00,
+    /* (7fe0,0010) OW 4096 */
+    0xe0, 0x7f, 0x10, 0x00, 'O', 'W', 0x00, 0x00, 0x00, 0x10, 0x00, 0x00};
+
+/* defined length sequence and items, the last item is empty */
+static const unsigned char defined[] = {
+    /* (0008,1115) SQ 28 */
+    0x08, 0x00, 0x15, 0x11, 'S', 'Q', 0x00, 0x00, 0x1c, 0x00, 0x00, 0x00,
+    /* item 12 */
+    0xfe, 0xff, 0x00, 0xe0, 0x0c, 0x00, 0x00, 0x00,
+    /* (0008,1150) UI 4 */
+    0x08, 0x00, 0x50, 0x11, 'U', 'I', 0x04, 0x00, '1', '.', '2', 0x00,
+    /* item 0 */
+    0xfe, 0xff, 0x00, 0xe0, 0x00, 0x00, 0x00, 0x00,
+    /* (0010,0010) PN 4 */
+    0x10, 0x00, 0x10, 0x00, 'P', 'N', 0x04, 0x00, 'A', '^', 'B', ' '};
+
+/* implicit VR little endian */
+static const unsigned char implicit[] = {
+    /* (0008,0060) 2 */
+    0x08, 0x00, 0x60, 0x00, 0x02, 0x00, 0x00, 0x00, 'M', 'R',
+    /* (0008,1115) u/l */
+    0x08, 0x00, 0x15, 0x11, 0xff, 0xff, 0xff, 0xff,
+    /* item u/l */
+    0xfe, 0xff, 0x00, 0xe0, 0xff, 0xff, 0xff, 0xff,
+    /* (0008,1150) 4 */
+    0x08, 0x00, 0x50, 0x11, 0x04, 0x00, 0x00, 0x00, '1', '.', '2', 0x00,
+    /* item end */
+    0xfe, 0xff, 0x0d, 0xe0, 0x00, 0x00, 0x00, 0x00,
+    /* sequence end */
+    0xfe, 0xff, 0xdd, 0xe0, 0x00, 0x00, 0x00, 0x00,
+    /* (0009,0010) private creator 4 */
+    0x09, 0x00, 0x10, 0x00, 0x04, 0x00, 0x00, 0x00, 'A', 'C', 'M', 'E',
+    /* (0009,1001) 2 */
+    0x09, 0x00, 0x01, 0x10, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* (7fe0,0010) 2 */
+    0xe0, 0x7f, 0x10, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+/* explicit VR big endian, ends with 17 OW words */
+static const unsigned char big_endian[] = {
+    /* (0028,0010) US 2 */
+    0x00, 0x28, 0x00, 0x10, 'U', 'S', 0x00, 0x02, 0x02, 0x00,
+    /* (0008,1115) SQ u/l */
+    0x00, 0x08, 0x11, 0x15, 'S', 'Q', 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+    /* item u/l */
+    0xff, 0xfe, 0xe0, 0x00, 0xff, 0xff, 0xff, 0xff,
+    /* (0008,1150) UI 4 */
+    0x00, 0x08, 0x11, 0x50, 'U', 'I', 0x00, 0x04, '1', '.', '2', 0x00,
+    /* item end */
+    0xff, 0xfe, 0xe0, 0x0d, 0x00, 0x00, 0x00, 0x00,
+    /* sequence end */
+    0xff, 0xfe, 0xe0, 0xdd, 0x00, 0x00, 0x00, 0x00,
+    /* (0018,9087) FD 8 */
+    0x00, 0x18, 0x90, 0x87, 'F', 'D', 0x00, 0x08, 0x3f, 0xf8, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    /* (7fe0,0010) OW 34 */
+    0x7f, 0xe0, 0x00, 0x10, 'O', 'W', 0x00, 0x00, 0x00, 0x00, 0x00, 0x22};
+
+/* Part 10 file: preamble, DICM prefix, File Meta Information */
+static const unsigned char meta[] = {
+    /* (0002,0000) UL 4 */
+    0x02, 0x00, 0x00, 0x00, 'U', 'L', 0x04, 0x00, 0x1a, 0x00, 0x00, 0x00,
+    /* (0002,0010) UI 18, Implicit VR Little Endian */
+    0x02, 0x00, 0x10, 0x00, 'U', 'I', 0x12, 0x00, '1', '.', '2', '.', '8',
+    '4', '0', '.', '1', '0', '0', '0', '8', '.', '1', '.', '2', 0x00};
+
+enum { LARGE_VL = 4096, NUM_EVENTS = 13, NUM_WORDS = 17, PREAMBLE = 132 };
+
+static unsigned char dataset[sizeof header + LARGE_VL];
+
+/* reference: one event at a time */
+static int expected[NUM_EVENTS];
+
+static int single(void) {
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  if (dicm_io_mem_create(&src, dataset, sizeof dataset)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  int n = 0;
+  while (dicm_reader_hasnext(reader)) {
+    if (n == NUM_EVENTS) return 1;
+    expected[n++] = dicm_reader_next_event(reader);
+  }
+  if (n != NUM_EVENTS) return 1;
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return 0;
+}
+
+static int batched(size_t batch_size) {
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  struct dicm_event_rec recs[NUM_EVENTS];
+  if (dicm_io_mem_create(&src, dataset, sizeof dataset)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  int n = 0;
+  int count;
+  while ((count = dicm_reader_next_events(reader, recs, batch_size)) > 0) {
+    for (int i = 0; i < count; ++i) {
+      const struct dicm_event_rec *rec = &recs[i];
+      if (n == NUM_EVENTS || (int)rec->event != expected[n++]) return 1;
+      if (rec->event != EVENT_VALUE) continue;
+      if (rec->da.tag == 0x00081150) {
+        if (!rec->value || memcmp(rec->value, "1.2", 4)) return 1;
+      } else if (rec->da.tag == 0x7fe00010) {
+        /* too large to be inlined, always ends the batch */
+        if (rec->value || i != count - 1) return 1;
+        char buf[LARGE_VL];
+        if (dicm_reader_read_value(reader, buf, sizeof buf)) return 1;
+        if (memcmp(buf, dataset + sizeof header, sizeof buf)) return 1;
+      }
+    }
+  }
+  if (count != 0 || n != NUM_EVENTS) return 1;
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return 0;
+}
+
+/* push mode: record events, skip the subtree of one of them */
+struct recorder {
+  int events[NUM_EVENTS];
+  int n;
+  int skip;
+};
+
+static int record(struct recorder *rec, int event) {
+  if (rec->n == NUM_EVENTS) return -1;
+  rec->events[rec->n++] = event;
+  return event == rec->skip ? DICM_PARSE_SKIP : DICM_PARSE_CONTINUE;
+}
+
+static int on_start_dataset(void *ctx, DICM_UNUSED const char *encoding) {
+  return record(ctx, EVENT_START_DATASET);
+}
+static int on_end_dataset(void *ctx) { return record(ctx, EVENT_END_DATASET); }
+static int on_attribute(void *ctx, const struct dicm_attribute *da) {
+  /* only the sequence attribute can be skipped */
+  const int res = record(ctx, EVENT_ATTRIBUTE);
+  return da->vr == VR_SQ ? res : DICM_PARSE_CONTINUE;
+}
+static int on_value(void *ctx, DICM_UNUSED struct dicm_reader *reader,
+                    DICM_UNUSED size_t size) {
+  return record(ctx, EVENT_VALUE);
+}
+static int on_start_item(void *ctx) { return record(ctx, EVENT_START_ITEM); }
+static int on_end_item(void *ctx) { return record(ctx, EVENT_END_ITEM); }
+static int on_start_sequence(void *ctx) {
+  return record(ctx, EVENT_START_SEQUENCE);
+}
+static int on_end_sequence(void *ctx) {
+  return record(ctx, EVENT_END_SEQUENCE);
+}
+
+static const struct dicm_handlers handlers = {
+    .start_dataset = on_start_dataset,
+    .end_dataset = on_end_dataset,
+    .attribute = on_attribute,
+    .value = on_value,
+    .start_item = on_start_item,
+    .end_item = on_end_item,
+    .start_sequence = on_start_sequence,
+    .end_sequence = on_end_sequence};
+
+static int parse(const void *buf, size_t size, int skip, const int *events,
+                 int n) {
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  struct recorder rec = {.n = 0, .skip = skip};
+  if (dicm_io_mem_create(&src, buf, size)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (dicm_reader_parse(reader, &handlers, &rec)) return 1;
+  if (rec.n != n || memcmp(rec.events, events, (size_t)n * sizeof *events))
+    return 1;
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return 0;
+}
+
+/* incremental mode, chunk_size bytes at a time */
+static int feed(size_t chunk_size) {
+  struct dicm_parser *parser;
+  if (dicm_parser_create(&parser)) return 1;
+  unsigned char value[LARGE_VL];
+  size_t value_size = 0;
+  size_t value_left = 0;
+  size_t fed = 0;
+  int n = 0;
+  while (n != NUM_EVENTS) {
+    const size_t len =
+        sizeof dataset - fed < chunk_size ? sizeof dataset - fed : chunk_size;
+    int next = dicm_parser_feed(parser, dataset + fed, len);
+    fed += len;
+    if (fed == sizeof dataset && dicm_parser_finish(parser)) return 1;
+    /* drain */
+    for (; next != DICM_PARSER_NEED_MORE_DATA;
+         next = dicm_parser_feed(parser, NULL, 0)) {
+      /* a continuation of the current value does not count as an event */
+      if (next != EVENT_VALUE || value_left == 0) {
+        if (n == NUM_EVENTS || next != expected[n++]) return 1;
+        if (next == EVENT_VALUE) {
+          struct dicm_attribute da;
+          if (dicm_parser_get_attribute(parser, &da)) return 1;
+          value_size = 0;
+          value_left = da.vl;
+        }
+      }
+      if (next == EVENT_END_DATASET) break;
+      if (next != EVENT_VALUE) continue;
+      /* the large value comes in pieces, the first one may be empty */
+      const size_t read =
+          dicm_parser_read_value(parser, value + value_size, value_left);
+      value_size += read;
+      value_left -= read;
+    }
+  }
+  if (value_size != LARGE_VL || memcmp(value, dataset + sizeof header, LARGE_VL))
+    return 1;
+  if (dicm_parser_destroy(parser)) return 1;
+  return 0;
+}
+
+/* incremental mode, the stream ends after size bytes of dataset */
+static int truncated_feed(size_t size) {
+  struct dicm_parser *parser;
+  if (dicm_parser_create(&parser)) return 1;
+  int next = dicm_parser_feed(parser, dataset, size);
+  if (dicm_parser_finish(parser)) return 1;
+  /* the events before the cut, then invalid data rather than more to come */
+  for (int n = 0; next >= 0; next = dicm_parser_feed(parser, NULL, 0)) {
+    if (n++ == NUM_EVENTS || next == EVENT_END_DATASET) return 1;
+  }
+  if (next != -1) return 1;
+  if (dicm_parser_destroy(parser)) return 1;
+  return 0;
+}
+
+/* pull mode, leave out the subtree of the sequence attribute */
+static int skipped(void) {
+  static const int events[] = {EVENT_START_DATASET, EVENT_ATTRIBUTE,
+                               EVENT_VALUE,         EVENT_ATTRIBUTE,
+                               EVENT_ATTRIBUTE,     EVENT_VALUE,
+                               EVENT_END_DATASET};
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  if (dicm_io_mem_create(&src, dataset, sizeof dataset)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  int i = 0;
+  while (dicm_reader_hasnext(reader)) {
+    const int next = dicm_reader_next_event(reader);
+    if (i == 7 || next != events[i++]) return 1;
+    if (i == 4 && dicm_reader_skip_subtree(reader)) return 1;
+  }
+  if (i != 7) return 1;
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return 0;
+}
+
+/* VRs of implicit, from the dictionary */
+static const dicm_vr_t implicit_vrs[] = {VR_CS, VR_SQ, VR_UI,
+                                         VR_LO, VR_UN, VR_OW};
+
+static int implicit_vr(void) {
+  const size_t n = sizeof implicit_vrs / sizeof *implicit_vrs;
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  if (dicm_io_mem_create(&src, implicit, sizeof implicit)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (dicm_reader_set_vr_encoding(reader, DICM_VR_IMPLICIT)) return 1;
+  size_t i = 0;
+  while (dicm_reader_hasnext(reader)) {
+    const int next = dicm_reader_next_event(reader);
+    if (next < 0) return 1;
+    if (next != EVENT_ATTRIBUTE) continue;
+    struct dicm_attribute da;
+    if (dicm_reader_get_attribute(reader, &da)) return 1;
+    if (i == n || da.vr != implicit_vrs[i++]) return 1;
+  }
+  if (i != n) return 1;
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return 0;
+}
+
+/* incremental mode one byte at a time, encoding selected up front */
+static int implicit_feed(void) {
+  const size_t n = sizeof implicit_vrs / sizeof *implicit_vrs;
+  struct dicm_parser *parser;
+  if (dicm_parser_create(&parser)) return 1;
+  if (dicm_parser_set_vr_encoding(parser, DICM_VR_IMPLICIT)) return 1;
+  size_t i = 0;
+  int next = DICM_PARSER_NEED_MORE_DATA;
+  for (size_t fed = 0; next != EVENT_END_DATASET; ++fed) {
+    if (fed == sizeof implicit) {
+      if (dicm_parser_finish(parser)) return 1;
+      next = dicm_parser_feed(parser, NULL, 0);
+    } else {
+      next = dicm_parser_feed(parser, implicit + fed, 1);
+    }
+    for (; next != DICM_PARSER_NEED_MORE_DATA && next != EVENT_END_DATASET;
+         next = dicm_parser_feed(parser, NULL, 0)) {
+      if (next < 0) return 1;
+      if (next != EVENT_ATTRIBUTE) continue;
+      struct dicm_attribute da;
+      if (dicm_parser_get_attribute(parser, &da)) return 1;
+      if (i == n || da.vr != implicit_vrs[i++]) return 1;
+    }
+    /* too late */
+    if (!dicm_parser_set_vr_encoding(parser, DICM_VR_EXPLICIT)) return 1;
+  }
+  if (i != n) return 1;
+  if (dicm_parser_destroy(parser)) return 1;
+  return 0;
+}
+
+/* words of binary values read little endian, text left as is */
+static int big_endian_values(void) {
+  static const dicm_tag_t tags[] = {0x00280010, 0x00081115, 0x00081150,
+                                    0x00189087, 0x7fe00010};
+  unsigned char buf[sizeof big_endian + 2 * NUM_WORDS];
+  memcpy(buf, big_endian, sizeof big_endian);
+  for (size_t i = 0; i < NUM_WORDS; ++i) {
+    buf[sizeof big_endian + 2 * i] = (unsigned char)(i >> 8u);
+    buf[sizeof big_endian + 2 * i + 1] = (unsigned char)i;
+  }
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  if (dicm_io_mem_create(&src, buf, sizeof buf)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (dicm_reader_set_vr_encoding(reader, DICM_VR_EXPLICIT_BE)) return 1;
+  size_t i = 0;
+  struct dicm_attribute da;
+  while (dicm_reader_hasnext(reader)) {
+    const int next = dicm_reader_next_event(reader);
+    if (next < 0) return 1;
+    if (next == EVENT_ATTRIBUTE) {
+      if (dicm_reader_get_attribute(reader, &da)) return 1;
+      if (i == sizeof tags / sizeof *tags || da.tag != tags[i++]) return 1;
+    }
+    if (next != EVENT_VALUE) continue;
+    const void *view;
+    unsigned char value[2 * NUM_WORDS];
+    if (dicm_reader_get_attribute(reader, &da)) return 1;
+    switch (da.vr) {
+      case VR_US: {
+        /* neither borrowed nor read by halves */
+        if (!dicm_reader_borrow_value(reader, &view, 2)) return 1;
+        if (!dicm_reader_read_value(reader, value, 1)) return 1;
+        uint16_t us;
+        if (dicm_reader_read_value(reader, value, 2)) return 1;
+        memcpy(&us, value, 2);
+        if (us != 512) return 1;
+      } break;
+      case VR_UI:
+        if (dicm_reader_read_value(reader, value, 4)) return 1;
+        if (memcmp(value, "1.2", 4) != 0) return 1;
+        break;
+      case VR_FD: {
+        double fd;
+        if (dicm_reader_read_value(reader, value, 8)) return 1;
+        memcpy(&fd, value, 8);
+        if (fd != 1.5) return 1;
+      } break;
+      case VR_OW:
+        if (da.vl != 2 * NUM_WORDS) return 1;
+        if (dicm_reader_read_value(reader, value, 2 * NUM_WORDS)) return 1;
+        for (size_t w = 0; w < NUM_WORDS; ++w) {
+          uint16_t ow;
+          memcpy(&ow, value + 2 * w, 2);
+          if (ow != w) return 1;
+        }
+        break;
+      default:
+        return 1;
+    }
+  }
+  if (i != sizeof tags / sizeof *tags) return 1;
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return 0;
+}
+
+/* typed arrays: big endian OW widened to int32 in two calls, FD as is, US to
+ * double; little endian SS widened to int32 and FL to double, past a vector
+ * register */
+static int typed_values(void) {
+  unsigned char buf[sizeof big_endian + 2 * NUM_WORDS];
+  memcpy(buf, big_endian, sizeof big_endian);
+  for (size_t i = 0; i < NUM_WORDS; ++i) {
+    buf[sizeof big_endian + 2 * i] = (unsigned char)(i >> 8u);
+    buf[sizeof big_endian + 2 * i + 1] = (unsigned char)i;
+  }
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  if (dicm_io_mem_create(&src, buf, sizeof buf)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (dicm_reader_set_vr_encoding(reader, DICM_VR_EXPLICIT_BE)) return 1;
+  struct dicm_attribute da;
+  size_t count;
+  while (dicm_reader_hasnext(reader)) {
+    const int next = dicm_reader_next_event(reader);
+    if (next < 0) return 1;
+    if (next != EVENT_VALUE) continue;
+    if (dicm_reader_get_attribute(reader, &da)) return 1;
+    switch (da.vr) {
+      case VR_US: {
+        double us;
+        /* no narrowing */
+        if (!dicm_reader_read_values(reader, DICM_VALUE_INT16, &us, 1,
+                                     &count)) {
+          return 1;
+        }
+        if (dicm_reader_read_values(reader, DICM_VALUE_FLOAT64, &us, 1,
+                                    &count)) {
+          return 1;
+        }
+        if (count != 1 || us != 512) return 1;
+      } break;
+      case VR_UI: {
+        char ui[4];
+        if (!dicm_reader_read_values(reader, DICM_VALUE_UINT16, ui, 2,
+                                     &count)) {
+          return 1;
+        }
+      } break;
+      case VR_FD: {
+        double fd;
+        if (dicm_reader_read_values(reader, DICM_VALUE_FLOAT64, &fd, 1,
+                                    &count)) {
+          return 1;
+        }
+        if (count != 1 || fd != 1.5) return 1;
+      } break;
+      case VR_OW: {
+        int32_t ow[NUM_WORDS + 1];
+        size_t total = 0;
+        if (dicm_reader_read_values(reader, DICM_VALUE_INT32, ow, 5, &count)) {
+          return 1;
+        }
+        total += count;
+        if (dicm_reader_read_values(reader, DICM_VALUE_INT32, ow + total,
+                                    NUM_WORDS + 1 - total, &count)) {
+          return 1;
+        }
+        total += count;
+        if (total != NUM_WORDS) return 1;
+        for (size_t w = 0; w < NUM_WORDS; ++w) {
+          if (ow[w] != (int32_t)w) return 1;
+        }
+        /* end of value */
+        if (dicm_reader_read_values(reader, DICM_VALUE_INT32, ow, 1, &count) ||
+            count != 0) {
+          return 1;
+        }
+      } break;
+      default:
+        return 1;
+    }
+  }
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+
+  static const unsigned char numbers[] = {
+      /* (0028,0106) SS 22 */
+      0x28, 0x00, 0x06, 0x01, 'S', 'S', 0x16, 0x00, 0xfb, 0xff, 0xfc, 0xff,
+      0xfd, 0xff, 0xfe, 0xff, 0xff, 0xff, 0x00, 0x00, 0x01, 0x00, 0x02, 0x00,
+      0x03, 0x00, 0x04, 0x00, 0x00, 0x80,
+      /* (0070,0022) FL 20 */
+      0x70, 0x00, 0x22, 0x00, 'F', 'L', 0x14, 0x00, 0x00, 0x00, 0xc0, 0x3f,
+      0x00, 0x00, 0x10, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x3e,
+      0x00, 0x00, 0x48, 0x43};
+  static const int32_t ss[] = {-5, -4, -3, -2, -1, 0, 1, 2, 3, 4, -32768};
+  static const double fl[] = {1.5, -2.25, 0, 0.25, 200};
+  if (dicm_io_mem_create(&src, numbers, sizeof numbers)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  while (dicm_reader_hasnext(reader)) {
+    const int next = dicm_reader_next_event(reader);
+    if (next < 0) return 1;
+    if (next != EVENT_VALUE) continue;
+    if (dicm_reader_get_attribute(reader, &da)) return 1;
+    if (da.vr == VR_SS) {
+      int32_t values[11];
+      if (dicm_reader_read_values(reader, DICM_VALUE_INT32, values, 11,
+                                  &count)) {
+        return 1;
+      }
+      if (count != 11 || memcmp(values, ss, sizeof ss)) return 1;
+    } else {
+      double values[5];
+      if (dicm_reader_read_values(reader, DICM_VALUE_FLOAT64, values, 5,
+                                  &count)) {
+        return 1;
+      }
+      if (count != 5 || memcmp(values, fl, sizeof fl)) return 1;
+    }
+  }
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return 0;
+}
+
+/* VRs of the attributes, encoding left to the reader */
+static int detected(const void *buf, size_t size, const dicm_vr_t *vrs,
+                    size_t n, const char *transfer_syntax,
+                    size_t block_size) {
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  if (dicm_io_mem_create(&src, buf, size)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (block_size && dicm_reader_set_block_size(reader, block_size)) return 1;
+  size_t i = 0;
+  while (dicm_reader_hasnext(reader)) {
+    const int next = dicm_reader_next_event(reader);
+    if (next < 0) return 1;
+    if (next == EVENT_START_DATASET) {
+      char uid[65];
+      const int err = dicm_reader_get_transfer_syntax(reader, uid, sizeof uid);
+      if (transfer_syntax ? err || strcmp(uid, transfer_syntax) != 0 : !err) {
+        return 1;
+      }
+    }
+    if (next != EVENT_ATTRIBUTE) continue;
+    struct dicm_attribute da;
+    if (dicm_reader_get_attribute(reader, &da)) return 1;
+    if (i == n || da.vr != vrs[i++]) return 1;
+  }
+  if (i != n) return 1;
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return 0;
+}
+
+static int part10(void) {
+  static const dicm_vr_t vrs[] = {VR_UL, VR_UI, VR_CS, VR_SQ,
+                                  VR_UI, VR_LO, VR_UN, VR_OW};
+  static unsigned char file[PREAMBLE + sizeof meta + sizeof implicit];
+  memcpy(file + 128, "DICM", 4);
+  memcpy(file + PREAMBLE, meta, sizeof meta);
+  memcpy(file + PREAMBLE + sizeof meta, implicit, sizeof implicit);
+  return detected(file, sizeof file, vrs, 8, "1.2.840.10008.1.2", 0);
+}
+
+/* smallest read-ahead block: the File Meta Information only has to fit up to
+ * its Transfer Syntax UID, the group length tells where it ends */
+static int small_block(void) {
+  static const dicm_vr_t vrs[] = {VR_UL, VR_UI, VR_OB, VR_CS, VR_SQ,
+                                  VR_UI, VR_LO, VR_UN, VR_OW};
+  /* (0002,0102) OB 200 */
+  static const unsigned char private_info[12] = {
+      0x02, 0x00, 0x02, 0x01, 'O', 'B', 0x00, 0x00, 0xc8, 0x00, 0x00, 0x00};
+  static unsigned char file[PREAMBLE + sizeof meta + sizeof private_info +
+                            200 + sizeof implicit];
+  unsigned char *p = file;
+  memcpy(p + 128, "DICM", 4);
+  p += PREAMBLE;
+  memcpy(p, meta, sizeof meta);
+  /* group length */
+  p[8] = sizeof meta - 12 + sizeof private_info + 200;
+  p += sizeof meta;
+  memcpy(p, private_info, sizeof private_info);
+  p += sizeof private_info + 200;
+  memcpy(p, implicit, sizeof implicit);
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  if (dicm_io_mem_create(&src, file, sizeof file)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  /* no room for the preamble */
+  if (!dicm_reader_set_block_size(reader, PREAMBLE - 1)) return 1;
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return detected(file, sizeof file, vrs, 9, "1.2.840.10008.1.2", PREAMBLE);
+}
+
+/* offsets of the defined length dataset, from the sidecar */
+static int indexed(void) {
+  struct dicm_io *src;
+  struct dicm_io *dst;
+  struct dicm_reader *reader;
+  if (dicm_io_mem_create(&src, defined, sizeof defined)) return 1;
+  if (dicm_io_memsink_create(&dst, 0)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (dicm_index_build(reader, dst)) return 1;
+  void *data;
+  size_t size;
+  if (dicm_io_memsink_release(dst, &data, &size)) return 1;
+  struct dicm_index *index;
+  if (dicm_index_create(&index, data, size)) return 1;
+
+  static const struct {
+    struct dicm_path_step steps[2];
+    size_t size;
+    io_offset offset;
+  } paths[] = {{{{.tag = 0x00081115}}, 1, 12},
+               {{{.tag = 0x00081115, .item = 1}, {.tag = 0x00081150}}, 2, 28},
+               {{{.tag = 0x00081115, .item = 2}}, 1, 40},
+               {{{.tag = 0x00100010}}, 1, 48}};
+  struct dicm_index_entry entry;
+  for (size_t i = 0; i < sizeof paths / sizeof *paths; ++i) {
+    const struct dicm_tag_path path = {paths[i].steps, paths[i].size};
+    if (dicm_index_find(index, &path, &entry)) return 1;
+    if (entry.offset != paths[i].offset) return 1;
+  }
+  {
+    /* no third item */
+    static const struct dicm_path_step steps[] = {
+        {.tag = 0x00081115, .item = 3}};
+    static const struct dicm_tag_path path = {steps, 1};
+    if (!dicm_index_find(index, &path, &entry)) return 1;
+  }
+
+  free(data);
+  if (dicm_index_destroy(index) || object_destroy(reader)) return 1;
+  if (object_destroy(src) || object_destroy(dst)) return 1;
+  return 0;
+}
+
+/* filtered: only the events along one tag path */
+static int filtered(const struct dicm_tag_path *path, const int *events,
+                    int n) {
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  if (dicm_io_mem_create(&src, dataset, sizeof dataset)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (dicm_reader_set_filter(reader, path, 1)) return 1;
+  int i = 0;
+  while (dicm_reader_hasnext(reader)) {
+    if (i == n || dicm_reader_next_event(reader) != events[i++]) return 1;
+  }
+  if (i != n) return 1;
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return 0;
+}
+
+/* early end of dataset, stop_tag 0 for header only */
+static int stopped(dicm_tag_t stop_tag, const int *events, int n) {
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  if (dicm_io_mem_create(&src, dataset, sizeof dataset)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (stop_tag ? dicm_reader_set_stop_tag(reader, stop_tag)
+               : dicm_reader_set_header_only(reader)) {
+    return 1;
+  }
+  int i = 0;
+  while (dicm_reader_hasnext(reader)) {
+    if (i == n || dicm_reader_next_event(reader) != events[i++]) return 1;
+  }
+  if (i != n) return 1;
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return 0;
+}
+
+int testdicm_events(DICM_UNUSED int argc, DICM_UNUSED char *argv[]) {
+  memcpy(dataset, header, sizeof header);
+  for (size_t i = 0; i < LARGE_VL; ++i) {
+    dataset[sizeof header + i] = (unsigned char)i;
+  }
+  if (single()) return 1;
+  for (size_t batch_size = 1; batch_size <= NUM_EVENTS; ++batch_size) {
+    if (batched(batch_size)) return 1;
+  }
+  if (parse(dataset, sizeof dataset, -1, expected, NUM_EVENTS)) return 1;
+  /* nothing nested under these, skipping them changes nothing */
+  if (parse(dataset, sizeof dataset, EVENT_VALUE, expected, NUM_EVENTS) ||
+      parse(dataset, sizeof dataset, EVENT_START_DATASET, expected,
+            NUM_EVENTS) ||
+      parse(dataset, sizeof dataset, EVENT_END_ITEM, expected, NUM_EVENTS)) {
+    return 1;
+  }
+  if (skipped()) return 1;
+  if (implicit_vr()) return 1;
+  if (implicit_feed()) return 1;
+  if (big_endian_values()) return 1;
+  if (typed_values()) return 1;
+  if (part10()) return 1;
+  if (small_block()) return 1;
+  if (indexed()) return 1;
+  {
+    /* raw datasets */
+    static const dicm_vr_t big_endian_vrs[] = {VR_US, VR_SQ, VR_UI, VR_FD,
+                                               VR_OW};
+    if (detected(implicit, sizeof implicit, implicit_vrs, 6, NULL, 0)) {
+      return 1;
+    }
+    static unsigned char words[sizeof big_endian + 2 * NUM_WORDS];
+    memcpy(words, big_endian, sizeof big_endian);
+    if (detected(words, sizeof words, big_endian_vrs, 5, NULL, 0)) return 1;
+  }
+  for (size_t chunk_size = 1; chunk_size <= sizeof dataset; chunk_size *= 3) {
+    if (feed(chunk_size)) return 1;
+  }
+  /* in the middle of the large value, then of its header */
+  if (truncated_feed(sizeof header + LARGE_VL / 2) ||
+      truncated_feed(sizeof header - 4)) {
+    return 1;
+  }
+  {
+    static const int events[] = {EVENT_START_DATASET, EVENT_ATTRIBUTE,
+                                 EVENT_VALUE,         EVENT_ATTRIBUTE,
+                                 EVENT_ATTRIBUTE,     EVENT_VALUE,
+                                 EVENT_END_DATASET};
+    if (parse(dataset, sizeof dataset, EVENT_ATTRIBUTE, events, 7)) return 1;
+  }
+  {
+    static const int events[] = {EVENT_START_DATASET,  EVENT_ATTRIBUTE,
+                                 EVENT_VALUE,          EVENT_ATTRIBUTE,
+                                 EVENT_START_SEQUENCE, EVENT_START_ITEM,
+                                 EVENT_END_ITEM,       EVENT_END_SEQUENCE,
+                                 EVENT_ATTRIBUTE,      EVENT_VALUE,
+                                 EVENT_END_DATASET};
+    if (parse(dataset, sizeof dataset, EVENT_START_ITEM, events, 11)) return 1;
+  }
+  {
+    static const struct dicm_path_step steps[] = {
+        {.tag = 0x00081115, .item = DICM_ANY_ITEM}, {.tag = 0x00081150}};
+    static const struct dicm_tag_path path = {.steps = steps, .size = 2};
+    static const int events[] = {
+        EVENT_START_DATASET, EVENT_ATTRIBUTE,  EVENT_START_SEQUENCE,
+        EVENT_START_ITEM,    EVENT_ATTRIBUTE,  EVENT_VALUE,
+        EVENT_END_ITEM,      EVENT_END_SEQUENCE, EVENT_END_DATASET};
+    if (filtered(&path, events, 9)) return 1;
+  }
+  {
+    static const struct dicm_path_step steps[] = {{.tag = 0x7fe00010}};
+    static const struct dicm_tag_path path = {.steps = steps, .size = 1};
+    static const int events[] = {EVENT_START_DATASET, EVENT_ATTRIBUTE,
+                                 EVENT_VALUE, EVENT_END_DATASET};
+    if (filtered(&path, events, 4)) return 1;
+  }
+  {
+    /* no second item: the sequence is walked, its only item left out */
+    static const struct dicm_path_step steps[] = {
+        {.tag = 0x00081115, .item = 2}, {.tag = 0x00081150}};
+    static const struct dicm_tag_path path = {.steps = steps, .size = 2};
+    static const int events[] = {EVENT_START_DATASET, EVENT_ATTRIBUTE,
+                                 EVENT_START_SEQUENCE, EVENT_END_SEQUENCE,
+                                 EVENT_END_DATASET};
+    if (filtered(&path, events, 5)) return 1;
+  }
+  {
+    static const int events[] = {
+        EVENT_START_DATASET, EVENT_ATTRIBUTE,  EVENT_START_SEQUENCE,
+        EVENT_START_ITEM,    EVENT_ATTRIBUTE,  EVENT_VALUE,
+        EVENT_END_ITEM,      EVENT_START_ITEM, EVENT_END_ITEM,
+        EVENT_END_SEQUENCE,  EVENT_ATTRIBUTE,  EVENT_VALUE,
+        EVENT_END_DATASET};
+    if (parse(defined, sizeof defined, -1, events, 13)) return 1;
+  }
+  {
+    /* seeked over */
+    static const int events[] = {EVENT_START_DATASET, EVENT_ATTRIBUTE,
+                                 EVENT_ATTRIBUTE, EVENT_VALUE,
+                                 EVENT_END_DATASET};
+    if (parse(defined, sizeof defined, EVENT_ATTRIBUTE, events, 5)) return 1;
+  }
+  {
+    static const int events[] = {EVENT_START_DATASET, EVENT_ATTRIBUTE,
+                                 EVENT_START_SEQUENCE, EVENT_END_SEQUENCE,
+                                 EVENT_ATTRIBUTE, EVENT_VALUE,
+                                 EVENT_END_DATASET};
+    if (parse(defined, sizeof defined, EVENT_START_SEQUENCE, events, 7))
+      return 1;
+  }
+  {
+    static const int events[] = {
+        EVENT_START_DATASET, EVENT_ATTRIBUTE,  EVENT_START_SEQUENCE,
+        EVENT_START_ITEM,    EVENT_END_ITEM,   EVENT_START_ITEM,
+        EVENT_END_ITEM,      EVENT_END_SEQUENCE, EVENT_ATTRIBUTE,
+        EVENT_VALUE,         EVENT_END_DATASET};
+    if (parse(defined, sizeof defined, EVENT_START_ITEM, events, 11)) return 1;
+  }
+  {
+    static const int events[] = {EVENT_START_DATASET, EVENT_ATTRIBUTE,
+                                 EVENT_VALUE, EVENT_END_DATASET};
+    if (stopped(0x00081000, events, 4)) return 1;
+  }
+  {
+    /* (0008,1150) is above the stop tag, but nested */
+    static const int events[] = {
+        EVENT_START_DATASET,  EVENT_ATTRIBUTE,    EVENT_VALUE,
+        EVENT_ATTRIBUTE,      EVENT_START_SEQUENCE, EVENT_START_ITEM,
+        EVENT_ATTRIBUTE,      EVENT_VALUE,        EVENT_END_ITEM,
+        EVENT_END_SEQUENCE,   EVENT_END_DATASET};
+    if (stopped(0x00081116, events, 11)) return 1;
+    if (stopped(0, events, 11)) return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
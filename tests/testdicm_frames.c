@@ -0,0 +1,311 @@
+#include "dicm-frames.h"
+#include "dicm-io.h"
+#include "dicm-reader.h"
+
+#include <stdbool.h>
+#include <stdlib.h> /* EXIT_SUCCESS */
+#include <string.h>
+
+/* two frames, the first one in two fragments, located by the Basic Offset
+ * Table */
+static unsigned char basic[] = {
+    /* (0028,0008) IS 2 */
+    0x28, 0x00, 0x08, 0x00, 'I', 'S', 0x02, 0x00, '2', ' ',
+    /* (7fe0,0010) OB u/l */
+    0xe0, 0x7f, 0x10, 0x00, 'O', 'B', 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+    /* Basic Offset Table 8 */
+    0xfe, 0xff, 0x00, 0xe0, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x14, 0x00, 0x00, 0x00,
+    /* fragment 4 */
+    0xfe, 0xff, 0x00, 0xe0, 0x04, 0x00, 0x00, 0x00, 'a', 'b', 'c', 'd',
+    /* fragment 0 */
+    0xfe, 0xff, 0x00, 0xe0, 0x00, 0x00, 0x00, 0x00,
+    /* fragment 6 */
+    0xfe, 0xff, 0x00, 0xe0, 0x06, 0x00, 0x00, 0x00, 'e', 'f', 'g', 'h', 'i',
+    'j',
+    /* sequence end */
+    0xfe, 0xff, 0xdd, 0xe0, 0x00, 0x00, 0x00, 0x00};
+
+/* same fragments, empty Basic Offset Table: one frame per fragment */
+static unsigned char scanned[] = {
+    /* (0028,0008) IS 2 */
+    0x28, 0x00, 0x08, 0x00, 'I', 'S', 0x02, 0x00, '3', ' ',
+    /* (7fe0,0010) OB u/l */
+    0xe0, 0x7f, 0x10, 0x00, 'O', 'B', 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+    /* Basic Offset Table 0 */
+    0xfe, 0xff, 0x00, 0xe0, 0x00, 0x00, 0x00, 0x00,
+    /* fragment 4 */
+    0xfe, 0xff, 0x00, 0xe0, 0x04, 0x00, 0x00, 0x00, 'a', 'b', 'c', 'd',
+    /* fragment 0 */
+    0xfe, 0xff, 0x00, 0xe0, 0x00, 0x00, 0x00, 0x00,
+    /* fragment 6 */
+    0xfe, 0xff, 0x00, 0xe0, 0x06, 0x00, 0x00, 0x00, 'e', 'f', 'g', 'h', 'i',
+    'j',
+    /* sequence end */
+    0xfe, 0xff, 0xdd, 0xe0, 0x00, 0x00, 0x00, 0x00};
+
+/* Extended Offset Table and its lengths */
+static const unsigned char extended[] = {
+    /* (0028,0008) IS 2 */
+    0x28, 0x00, 0x08, 0x00, 'I', 'S', 0x02, 0x00, '2', ' ',
+    /* (7fe0,0001) OV 16 */
+    0xe0, 0x7f, 0x01, 0x00, 'O', 'V', 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    /* (7fe0,0002) OV 16 */
+    0xe0, 0x7f, 0x02, 0x00, 'O', 'V', 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+    0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    /* (7fe0,0010) OB u/l */
+    0xe0, 0x7f, 0x10, 0x00, 'O', 'B', 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+    /* Basic Offset Table 0 */
+    0xfe, 0xff, 0x00, 0xe0, 0x00, 0x00, 0x00, 0x00,
+    /* fragment 4 */
+    0xfe, 0xff, 0x00, 0xe0, 0x04, 0x00, 0x00, 0x00, 'a', 'b', 'c', 'd',
+    /* fragment 6 */
+    0xfe, 0xff, 0x00, 0xe0, 0x06, 0x00, 0x00, 0x00, 'e', 'f', 'g', 'h', 'i',
+    'j',
+    /* sequence end */
+    0xfe, 0xff, 0xdd, 0xe0, 0x00, 0x00, 0x00, 0x00};
+
+/* three 3x3 frames of one bit, packed back to back */
+static const unsigned char packed[] = {
+    /* (0028,0008) IS 2 */
+    0x28, 0x00, 0x08, 0x00, 'I', 'S', 0x02, 0x00, '3', ' ',
+    /* (0028,0010) US 2 */
+    0x28, 0x00, 0x10, 0x00, 'U', 'S', 0x02, 0x00, 0x03, 0x00,
+    /* (0028,0011) US 2 */
+    0x28, 0x00, 0x11, 0x00, 'U', 'S', 0x02, 0x00, 0x03, 0x00,
+    /* (0028,0100) US 2 */
+    0x28, 0x00, 0x00, 0x01, 'U', 'S', 0x02, 0x00, 0x01, 0x00,
+    /* (7fe0,0010) OB 4 */
+    0xe0, 0x7f, 0x10, 0x00, 'O', 'B', 0x00, 0x00, 0x04, 0x00, 0x00, 0x00,
+    0x55, 0x8f, 0x7b, 0x00};
+
+/* two 2x2 frames of one byte */
+static const unsigned char bytes[] = {
+    /* (0028,0008) IS 2 */
+    0x28, 0x00, 0x08, 0x00, 'I', 'S', 0x02, 0x00, '2', ' ',
+    /* (0028,0010) US 2 */
+    0x28, 0x00, 0x10, 0x00, 'U', 'S', 0x02, 0x00, 0x02, 0x00,
+    /* (0028,0011) US 2 */
+    0x28, 0x00, 0x11, 0x00, 'U', 'S', 0x02, 0x00, 0x02, 0x00,
+    /* (0028,0100) US 2 */
+    0x28, 0x00, 0x00, 0x01, 'U', 'S', 0x02, 0x00, 0x08, 0x00,
+    /* (7fe0,0010) OB 8 */
+    0xe0, 0x7f, 0x10, 0x00, 'O', 'B', 0x00, 0x00, 0x08, 0x00, 0x00, 0x00,
+    1, 2, 3, 4, 5, 6, 7, 8};
+
+/* explicit VR big endian, one 1x2 frame of 16 bits */
+static const unsigned char words[] = {
+    /* (0028,0010) US 2 */
+    0x00, 0x28, 0x00, 0x10, 'U', 'S', 0x00, 0x02, 0x00, 0x01,
+    /* (0028,0011) US 2 */
+    0x00, 0x28, 0x00, 0x11, 'U', 'S', 0x00, 0x02, 0x00, 0x02,
+    /* (0028,0100) US 2 */
+    0x00, 0x28, 0x01, 0x00, 'U', 'S', 0x00, 0x02, 0x00, 0x10,
+    /* (7fe0,0010) OW 4 */
+    0x7f, 0xe0, 0x00, 0x10, 'O', 'W', 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x01, 0x02, 0x03, 0x04};
+
+struct expected_frame {
+  size_t count;
+  struct dicm_fragment_range ranges[2];
+};
+
+/* frames are looked up backward, so that the io is seeked both ways */
+static int located(const void *buf, size_t size, size_t nframes,
+                   const struct expected_frame *expected) {
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  struct dicm_frames *frames;
+  if (dicm_io_mem_create(&src, buf, size)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (dicm_frames_create(&frames, reader)) return 1;
+  if (dicm_frames_get_count(frames) != nframes) return 1;
+  for (size_t k = nframes; k-- > 0;) {
+    struct dicm_fragment_range ranges[2];
+    size_t count;
+    if (dicm_frames_get_fragments(frames, k, ranges, 2, &count)) return 1;
+    if (count != expected[k].count) return 1;
+    for (size_t i = 0; i < count && i < 2; ++i) {
+      if (ranges[i].offset != expected[k].ranges[i].offset ||
+          ranges[i].length != expected[k].ranges[i].length) {
+        return 1;
+      }
+    }
+  }
+  if (!dicm_frames_get_fragments(frames, nframes, NULL, 0, NULL)) return 1;
+  if (dicm_frames_destroy(frames) || object_destroy(reader)) return 1;
+  if (object_destroy(src)) return 1;
+  return 0;
+}
+
+static int rejected(const void *buf, size_t size) {
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  struct dicm_frames *frames;
+  if (dicm_io_mem_create(&src, buf, size)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (!dicm_frames_create(&frames, reader) || frames) return 1;
+  if (object_destroy(reader) || object_destroy(src)) return 1;
+  return 0;
+}
+
+/* native frames, read backward then borrowed, or not when the last one
+ * cannot be */
+static int sliced(const void *buf, size_t size, size_t nframes,
+                  size_t frame_size, const unsigned char *expected,
+                  bool borrowed) {
+  struct dicm_io *src;
+  struct dicm_reader *reader;
+  struct dicm_frames *frames;
+  if (dicm_io_mem_create(&src, buf, size)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (dicm_frames_create(&frames, reader)) return 1;
+  if (dicm_frames_get_count(frames) != nframes) return 1;
+  if (dicm_frames_get_frame_size(frames) != frame_size) return 1;
+  for (size_t k = nframes; k-- > 0;) {
+    unsigned char frame[8];
+    memset(frame, 0xff, sizeof frame);
+    if (dicm_frames_read(frames, k, frame, frame_size)) return 1;
+    if (memcmp(frame, expected + k * frame_size, frame_size)) return 1;
+  }
+  const void *view;
+  size_t view_size;
+  for (size_t k = 0; borrowed && k < nframes; ++k) {
+    if (dicm_frames_borrow(frames, k, &view, &view_size)) return 1;
+    if (view_size != frame_size ||
+        memcmp(view, expected + k * frame_size, frame_size)) {
+      return 1;
+    }
+  }
+  if (!borrowed &&
+      !dicm_frames_borrow(frames, nframes - 1, &view, &view_size)) {
+    return 1;
+  }
+  if (!dicm_frames_read(frames, nframes, NULL, 0)) return 1;
+  if (dicm_frames_destroy(frames) || object_destroy(reader)) return 1;
+  if (object_destroy(src)) return 1;
+  return 0;
+}
+
+/* mem io that cannot lend its storage */
+struct copying {
+  struct dicm_io io;
+  struct dicm_io *mem;
+};
+
+static int copying_destroy(void *self_) {
+  struct copying *self = self_;
+  return object_destroy(self->mem);
+}
+
+static io_ssize copying_read(void *self_, void *buf, size_t size) {
+  struct copying *self = self_;
+  return dicm_io_read(self->mem, buf, size);
+}
+
+static io_offset copying_skip(void *self_, io_offset off) {
+  struct copying *self = self_;
+  return dicm_io_skip(self->mem, off);
+}
+
+static io_ssize copying_write(DICM_UNUSED void *self_,
+                              DICM_UNUSED const void *buf,
+                              DICM_UNUSED size_t size) {
+  return -1;
+}
+
+static const struct io_vtable copying_vtable = {
+    .object = {.fp_destroy = copying_destroy},
+    .io = {.fp_read = copying_read,
+           .fp_skip = copying_skip,
+           .fp_write = copying_write}};
+
+/* frames of the Basic Offset Table dataset gathered, with fragments lent by
+ * the io object or not */
+static int gathered(bool lent) {
+  struct copying copying = {.io = {.vtable = &copying_vtable}};
+  if (dicm_io_mem_create(&copying.mem, basic, sizeof basic)) return 1;
+  struct dicm_io *src = lent ? copying.mem : &copying.io;
+  struct dicm_reader *reader;
+  struct dicm_frames *frames;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (dicm_frames_create(&frames, reader)) return 1;
+  static const char *const expected[] = {"abcd", "efghij"};
+  for (size_t k = 2; k-- > 0;) {
+    const void *buf;
+    size_t size;
+    if (dicm_frames_gather(frames, k, &buf, &size)) return 1;
+    if (size != strlen(expected[k]) || memcmp(buf, expected[k], size)) {
+      return 1;
+    }
+  }
+  const struct dicm_iovec *iov;
+  size_t count;
+  if (dicm_frames_gather_iov(frames, 0, &iov, &count)) return 1;
+  if (count != 2 || iov[0].len != 4 || memcmp(iov[0].base, "abcd", 4) ||
+      iov[1].len != 0) {
+    return 1;
+  }
+  /* views on the caller memory, not copies */
+  if ((iov[0].base == basic + 46) != lent) return 1;
+  if (dicm_frames_destroy(frames) || object_destroy(reader)) return 1;
+  if (object_destroy(src)) return 1;
+  return 0;
+}
+
+int testdicm_frames(DICM_UNUSED int argc, DICM_UNUSED char *argv[]) {
+  {
+    static const struct expected_frame expected[] = {
+        {2, {{46, 4}, {58, 0}}}, {1, {{66, 6}}}};
+    if (located(basic, sizeof basic, 2, expected)) return 1;
+  }
+  if (gathered(true) || gathered(false)) return 1;
+  {
+    static const struct expected_frame expected[] = {
+        {1, {{38, 4}}}, {1, {{50, 0}}}, {1, {{58, 6}}}};
+    if (located(scanned, sizeof scanned, 3, expected)) return 1;
+    /* two frames in three fragments, no way to tell which is which */
+    scanned[8] = '2';
+    if (rejected(scanned, sizeof scanned)) return 1;
+    /* everything in one frame */
+    scanned[8] = '1';
+    static const struct expected_frame one[] = {{3, {{38, 4}, {50, 0}}}};
+    if (located(scanned, sizeof scanned, 1, one)) return 1;
+  }
+  {
+    static const struct expected_frame expected[] = {{1, {{94, 4}}},
+                                                     {1, {{106, 6}}}};
+    if (located(extended, sizeof extended, 2, expected)) return 1;
+  }
+  {
+    /* the Basic Offset Table disagrees with Number of Frames */
+    basic[8] = '3';
+    if (rejected(basic, sizeof basic)) return 1;
+  }
+  {
+    static const unsigned char expected[] = {0x55, 0x01, 0xc7,
+                                             0x01, 0x1e, 0x00};
+    if (sliced(packed, sizeof packed, 3, 2, expected, false)) return 1;
+    struct dicm_io *src;
+    struct dicm_reader *reader;
+    struct dicm_frames *frames;
+    if (dicm_io_mem_create(&src, packed, sizeof packed)) return 1;
+    if (dicm_reader_utf8_create(&reader, src)) return 1;
+    if (dicm_frames_create(&frames, reader)) return 1;
+    struct dicm_fragment_range range;
+    unsigned bit_offset;
+    if (dicm_frames_get_range(frames, 2, &range, &bit_offset)) return 1;
+    if (range.offset != 54 || range.length != 2 || bit_offset != 2) return 1;
+    if (dicm_frames_destroy(frames) || object_destroy(reader)) return 1;
+    if (object_destroy(src)) return 1;
+  }
+  if (sliced(bytes, sizeof bytes, 2, 4, bytes + 52, true)) return 1;
+  {
+    static const unsigned char expected[] = {0x02, 0x01, 0x04, 0x03};
+    if (sliced(words, sizeof words, 1, 4, expected, false)) return 1;
+  }
+  return EXIT_SUCCESS;
+}
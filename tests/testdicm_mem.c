@@ -0,0 +1,169 @@
+#include "dicm-io.h"
+#include "dicm-reader.h"
+#include "dicm-writer.h"
+
+#include <errno.h>  /* ENOSYS */
+#include <stdlib.h> /* EXIT_SUCCESS */
+#include <string.h>
+
+/* explicit little endian, undefined length sequence and item */
+static const unsigned char dataset[] = {
+    /* (0008,0060) CS 2 */
+    0x08, 0x00, 0x60, 0x00, 'C', 'S', 0x02, 0x00, 'C', 'T',
+    /* (0008,1115) SQ u/l */
+    0x08, 0x00, 0x15, 0x11, 'S', 'Q', 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+    /* item u/l */
+    0xfe, 0xff, 0x00, 0xe0, 0xff, 0xff, 0xff, 0xff,
+    /* (0008,1150) UI 4 */
+    0x08, 0x00, 0x50, 0x11, 'U', 'I', 0x04, 0x00, '1', '.', '2', 0x00,
+    /* item end */
+    0xfe, 0xff, 0x0d, 0xe0, 0x00, 0x00, 0x00, 0x00,
+    /* sequence end */
+    0xfe, 0xff, 0xdd, 0xe0, 0x00, 0x00, 0x00, 0x00,
+    /* (7fe0,0010) OW 4 */
+    0xe0, 0x7f, 0x10, 0x00, 'O', 'W', 0x00, 0x00, 0x04, 0x00, 0x00, 0x00,
+    0x01, 0x02, 0x03, 0x04};
+
+/* File Meta Information of a deflated dataset */
+static const unsigned char meta[] = {
+    /* (0002,0010) UI 22, Deflated Explicit VR Little Endian */
+    0x02, 0x00, 0x10, 0x00, 'U', 'I', 0x16, 0x00, '1', '.', '2', '.', '8',
+    '4', '0', '.', '1', '0', '0', '0', '8', '.', '1', '.', '2', '.', '1',
+    '.', '9', '9'};
+
+static int copy(struct dicm_reader *reader, struct dicm_writer *writer) {
+  struct dicm_attribute da;
+  char buf[32];
+  size_t size;
+  int res = 0;
+  while (dicm_reader_hasnext(reader)) {
+    const int next = dicm_reader_next_event(reader);
+    switch (next) {
+      case EVENT_ATTRIBUTE:
+        res |= dicm_reader_get_attribute(reader, &da);
+        res |= dicm_writer_write_attribute(writer, &da);
+        break;
+      case EVENT_VALUE:
+        res |= dicm_reader_get_value_length(reader, &size);
+        if (size > sizeof buf) return 1;
+        res |= dicm_writer_write_value_length(writer, size);
+        res |= dicm_reader_read_value(reader, buf, size);
+        res |= dicm_writer_write_value(writer, buf, size);
+        break;
+      case EVENT_START_ITEM:
+        res |= dicm_writer_write_start_item(writer);
+        break;
+      case EVENT_END_ITEM:
+        res |= dicm_writer_write_end_item(writer);
+        break;
+      case EVENT_START_SEQUENCE:
+        res |= dicm_writer_write_start_sequence(writer);
+        break;
+      case EVENT_END_SEQUENCE:
+        res |= dicm_writer_write_end_sequence(writer);
+        break;
+      case EVENT_START_DATASET:
+      case EVENT_END_DATASET:
+        break;
+      default:
+        return 1;
+    }
+  }
+  return res;
+}
+
+/* read src through the reader, check that it writes back expected */
+static int round_trip(struct dicm_io *src, const void *expected, size_t len) {
+  struct dicm_io *dst;
+  struct dicm_reader *reader;
+  struct dicm_writer *writer;
+  if (dicm_io_memsink_create(&dst, 0)) return 1;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (dicm_writer_utf8_create(&writer, dst)) return 1;
+  if (copy(reader, writer)) return 1;
+  void *data;
+  size_t size;
+  if (dicm_io_memsink_release(dst, &data, &size)) return 1;
+  const int res = size != len || memcmp(data, expected, size);
+  free(data);
+  if (object_destroy(reader) || object_destroy(writer)) return 1;
+  if (object_destroy(dst)) return 1;
+  return res;
+}
+
+/* compress what is written after prefix, read it back with format */
+static int deflated(int format, const void *prefix, size_t prefix_size,
+                    const void *expected, size_t len) {
+  struct dicm_io *sink;
+  struct dicm_io *deflate;
+  if (dicm_io_memsink_create(&sink, 0)) return 1;
+  const int err =
+      dicm_io_deflate_create(&deflate, sink, DICM_IO_WRITE, format, 9);
+  if (err == ENOSYS) return object_destroy(sink); /* built without zlib */
+  if (err) return 1;
+  if (dicm_io_write(sink, prefix, prefix_size) != (io_ssize)prefix_size) {
+    return 1;
+  }
+  if (dicm_io_write(deflate, dataset, sizeof dataset) !=
+      (io_ssize)sizeof dataset) {
+    return 1;
+  }
+  if (object_destroy(deflate)) return 1;
+  void *data;
+  size_t size;
+  if (dicm_io_memsink_release(sink, &data, &size)) return 1;
+  if (object_destroy(sink)) return 1;
+
+  struct dicm_io *src;
+  if (dicm_io_mem_adopt(&src, data, size)) return 1;
+  int res;
+  if (format == DICM_DEFLATE_GZIP) {
+    struct dicm_io *inflate;
+    if (dicm_io_deflate_create(&inflate, src, DICM_IO_READ, format, -1)) {
+      return 1;
+    }
+    res = round_trip(inflate, expected, len);
+    res |= object_destroy(inflate);
+  } else {
+    /* see dicm_reader_set_vr_encoding */
+    res = round_trip(src, expected, len);
+  }
+  return res | object_destroy(src);
+}
+
+int testdicm_mem(DICM_UNUSED int argc, DICM_UNUSED char *argv[]) {
+  struct dicm_io *src;
+  struct dicm_io *dst;
+  if (dicm_io_mem_create(&src, dataset, sizeof dataset)) return 1;
+  /* force a few reallocations */
+  if (dicm_io_memsink_create(&dst, 1)) return 1;
+
+  struct dicm_reader *reader;
+  struct dicm_writer *writer;
+  if (dicm_reader_utf8_create(&reader, src)) return 1;
+  if (dicm_writer_utf8_create(&writer, dst)) return 1;
+  if (copy(reader, writer)) return 1;
+
+  void *data;
+  size_t size;
+  if (dicm_io_memsink_release(dst, &data, &size)) return 1;
+  if (size != sizeof dataset || memcmp(data, dataset, size)) return 1;
+  free(data);
+  /* only a sink can be released */
+  if (!dicm_io_memsink_release(src, &data, &size)) return 1;
+
+  if (object_destroy(reader) || object_destroy(writer)) return 1;
+  if (object_destroy(src) || object_destroy(dst)) return 1;
+
+  /* .dcm.gz */
+  if (deflated(DICM_DEFLATE_GZIP, NULL, 0, dataset, sizeof dataset)) return 1;
+  /* deflated transfer syntax, the meta is written back uncompressed */
+  unsigned char file[sizeof meta + sizeof dataset];
+  memcpy(file, meta, sizeof meta);
+  memcpy(file + sizeof meta, dataset, sizeof dataset);
+  if (deflated(DICM_DEFLATE_RAW, meta, sizeof meta, file, sizeof file)) {
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}